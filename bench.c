@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static float randf(uint64_t *s) {
+    return (xorshift(s) >> 40) * (1.0f / (1 << 24));
+}
+
+// segments up to 256 units long, from points anywhere in the world bounds
+static void randomQueries(ZigLoadBSP *bsp, tracequery_t *q, size_t count, int32_t hull, uint64_t seed) {
+    ZigBSPModel *world = bsp->models;
+    for (size_t i = 0; i < count; i++) {
+        for (int k = 0; k < 3; k++) {
+            q[i].start[k] = world->mins[k] + randf(&seed) * (world->maxs[k] - world->mins[k]);
+            q[i].end[k] = q[i].start[k] + (randf(&seed) - 0.5f) * 512.0f;
+        }
+        q[i].hull = hull;
+    }
+}
+
+static void clipTrace(ZigLoadBSP *bsp, int32_t hull, vec3 start, vec3 end, pmtrace_t *trace) {
+    memset(trace, 0, sizeof(*trace));
+    trace->fraction = 1.0f;
+    trace->allsolid = true;
+    glm_vec3_copy(end, trace->endpos);
+    PM_ClipHullCheck(bsp, bsp->hull[hull], bsp->hull[hull], 0.0f, 1.0f, start, end, trace);
+    if (trace->allsolid)
+        trace->startsolid = true;
+    if (trace->startsolid)
+        trace->fraction = 0.0f;
+}
+
+// nodes and distinct cache lines on the way down to pos
+static void walkStats(ZigLoadBSP *bsp, int32_t hull, vec3 pos, size_t *nodes, size_t *clipLines, size_t *hullLines) {
+    uintptr_t lastC = 0, lastP = 0, lastH = 0;
+    for (int32_t num = bsp->hull[hull]; num >= 0;) {
+        clipnode_t *c = bsp->clipnode + num;
+        plane_t *p = bsp->planes + c->iPlane;
+        *clipLines += ((uintptr_t)c >> 6 != lastC) + ((uintptr_t)p >> 6 != lastP);
+        lastC = (uintptr_t)c >> 6;
+        lastP = (uintptr_t)p >> 6;
+        (*nodes)++;
+        num = c->iChilds[glm_vec3_dot(p->n, pos) - p->d < 0];
+    }
+    for (int32_t num = bsp->hroot[hull]; num >= 0;) {
+        hullnode_t *h = bsp->hullnode + num;
+        *hullLines += (uintptr_t)h >> 6 != lastH;
+        lastH = (uintptr_t)h >> 6;
+        num = h->iChilds[glm_vec3_dot(h->n, pos) - h->d < 0];
+    }
+}
+
+bool benchHull(ZigLoadBSP *bsp, size_t count, uint64_t seed) {
+    if (bsp->model_cnt == 0 || count == 0)
+        return true;
+    tracequery_t *q = malloc(sizeof(tracequery_t) * count);
+    int32_t *c1 = malloc(sizeof(int32_t) * count), *c2 = malloc(sizeof(int32_t) * count);
+    pmtrace_t *t1 = malloc(sizeof(pmtrace_t) * count), *t2 = malloc(sizeof(pmtrace_t) * count);
+    bool same = true;
+    for (int32_t hull = 0; hull < 3; hull++) {
+        randomQueries(bsp, q, count, hull, seed + hull);
+        size_t nodes = 0, clipLines = 0, hullLines = 0;
+        for (size_t i = 0; i < count; i++)
+            walkStats(bsp, hull, q[i].start, &nodes, &clipLines, &hullLines);
+
+        double t0 = now();
+        for (size_t i = 0; i < count; i++)
+            c1[i] = PM_ClipPointContents(bsp, bsp->hull[hull], q[i].start);
+        double tClip = now() - t0;
+        t0 = now();
+        for (size_t i = 0; i < count; i++)
+            c2[i] = PM_HullPointContents(bsp, bsp->hroot[hull], q[i].start);
+        double tHull = now() - t0;
+        bool pointSame = memcmp(c1, c2, sizeof(int32_t) * count) == 0;
+        printf("hull %d points: %.2f nodes, cache lines %.2f -> %.2f, %.1f -> %.1f Mq/s, %.2fx, same: %s\n",
+               hull, (double)nodes / count, (double)clipLines / count, (double)hullLines / count,
+               count / tClip * 1e-6, count / tHull * 1e-6, tClip / tHull, pointSame ? "yes" : "no");
+
+        t0 = now();
+        for (size_t i = 0; i < count; i++)
+            clipTrace(bsp, hull, q[i].start, q[i].end, t1 + i);
+        tClip = now() - t0;
+        t0 = now();
+        for (size_t i = 0; i < count; i++)
+            PM_TraceLine(bsp, hull, q[i].start, q[i].end, t2 + i);
+        tHull = now() - t0;
+        bool traceSame = memcmp(t1, t2, sizeof(pmtrace_t) * count) == 0;
+        printf("hull %d traces: %.2f -> %.2f Mq/s, %.2fx, same: %s\n",
+               hull, count / tClip * 1e-6, count / tHull * 1e-6, tClip / tHull, traceSame ? "yes" : "no");
+        same = same && pointSame && traceSame;
+    }
+    free(q);
+    free(c1);
+    free(c2);
+    free(t1);
+    free(t2);
+    return same;
+}
+
+bool benchGrid(ZigLoadBSP *bsp, size_t count, int threads, uint64_t seed) {
+    if (bsp->model_cnt == 0 || count == 0)
+        return true;
+    pool_t *pool = poolCreate(threads);
+    tracequery_t *q = malloc(sizeof(tracequery_t) * count);
+    int32_t *c1 = malloc(sizeof(int32_t) * count), *c2 = malloc(sizeof(int32_t) * count);
+    const float cells[] = {16.0f, 32.0f, 64.0f};
+    size_t hullBytes = sizeof(hullnode_t) * bsp->hnode_cnt;
+    bool same = true;
+    for (int32_t hull = 0; hull < 3; hull++) {
+        randomQueries(bsp, q, count, hull, seed + hull);
+        double t0 = now();
+        for (size_t i = 0; i < count; i++)
+            c1[i] = PM_HullPointContents(bsp, bsp->hroot[hull], q[i].start);
+        double tTree = now() - t0;
+        for (size_t k = 0; k < sizeof(cells) / sizeof(cells[0]); k++) {
+            hullgrid_t grid;
+            t0 = now();
+            if (!PM_GridBuild(pool, bsp, hull, cells[k], &grid)) {
+                printf("hull %d grid %g: out of memory\n", hull, cells[k]);
+                continue;
+            }
+            double tBuild = now() - t0;
+            t0 = now();
+            for (size_t i = 0; i < count; i++)
+                c2[i] = PM_GridPointContents(bsp, &grid, q[i].start);
+            double tGrid = now() - t0;
+            bool gridSame = memcmp(c1, c2, sizeof(int32_t) * count) == 0;
+            size_t nCells = grid.nBricks * 64;
+            printf("hull %d grid %g: build %.1f ms on %d threads, %.2f MiB (%.0f%% of hullnode), "
+                   "%zu/%zu bricks mixed, %.1f%% cells uniform, %.1f -> %.1f Mq/s, %.2fx, same: %s\n",
+                   hull, cells[k], tBuild * 1e3, poolSize(pool), grid.bytes / 1048576.0,
+                   hullBytes ? 100.0 * grid.bytes / hullBytes : 0.0, grid.nMixed, grid.nBricks,
+                   nCells ? 100.0 * grid.uniformCells / nCells : 0.0,
+                   count / tTree * 1e-6, count / tGrid * 1e-6, tTree / tGrid, gridSame ? "yes" : "no");
+            same = same && gridSame;
+            PM_GridFree(&grid);
+        }
+    }
+    free(q);
+    free(c1);
+    free(c2);
+    poolDestroy(pool);
+    return same;
+}
+
+static bool stopsRay(ZigLoadBSP *bsp, vec3 pos) {
+    int32_t contents = bsp->leaves[findLeaf(bsp, pos)].contents;
+    return contents == CONTENTS_SOLID || contents == CONTENTS_SKY;
+}
+
+bool benchRay(ZigLoadBSP *bsp, size_t count, int threads, uint64_t seed) {
+    if (bsp->model_cnt == 0 || bsp->nodecnt == 0 || count == 0)
+        return true;
+    pool_t *pool = poolCreate(threads);
+    tracequery_t *q = malloc(sizeof(tracequery_t) * count);
+    rayquery_t *rq = malloc(sizeof(rayquery_t) * count);
+    rayhit_t *h1 = malloc(sizeof(rayhit_t) * count), *h2 = malloc(sizeof(rayhit_t) * count);
+    pmtrace_t *t = malloc(sizeof(pmtrace_t) * count);
+    randomQueries(bsp, q, count, 0, seed);
+    for (size_t i = 0; i < count; i++) {
+        glm_vec3_copy(q[i].start, rq[i].start);
+        glm_vec3_copy(q[i].end, rq[i].end);
+    }
+
+    double t0 = now();
+    for (size_t i = 0; i < count; i++)
+        rayCast(bsp, rq[i].start, rq[i].end, h1 + i);
+    double tRay = now() - t0;
+    t0 = now();
+    rayCastBatch(pool, bsp, rq, h2, count);
+    double tRayBatch = now() - t0;
+    t0 = now();
+    for (size_t i = 0; i < count; i++)
+        PM_TraceLine(bsp, 0, q[i].start, q[i].end, t + i);
+    double tTrace = now() - t0;
+    t0 = now();
+    PM_TraceBatch(pool, bsp, q, t, count);
+    double tTraceBatch = now() - t0;
+    bool same = memcmp(h1, h2, sizeof(rayhit_t) * count) == 0;
+
+    // a little before a hit is open, a little after it is not
+    size_t hits = 0, startsolid = 0, agree = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (h1[i].startsolid) {
+            startsolid++;
+            continue;
+        }
+        if (h1[i].fraction >= 1.0f)
+            continue;
+        hits++;
+        vec3 dir, before, after;
+        glm_vec3_sub(rq[i].end, rq[i].start, dir);
+        float eps = 1.0f / 16.0f / glm_vec3_norm(dir);
+        glm_vec3_copy(rq[i].start, before);
+        glm_vec3_muladds(dir, h1[i].fraction - eps, before);
+        glm_vec3_copy(rq[i].start, after);
+        glm_vec3_muladds(dir, h1[i].fraction + eps, after);
+        agree += !stopsRay(bsp, before) && stopsRay(bsp, after);
+    }
+    printf("rays: %.1f Mq/s, batch %.1f Mq/s on %d threads, %.1f%% hit, %.1f%% start solid, "
+           "%.2f%% of hits agree with findLeaf, batch same: %s\n",
+           count / tRay * 1e-6, count / tRayBatch * 1e-6, poolSize(pool), 100.0 * hits / count,
+           100.0 * startsolid / count, hits ? 100.0 * agree / hits : 100.0, same ? "yes" : "no");
+    // hroot[0] is the standing player box (hull 1 of the file), not the
+    // point geometry of the render nodes, so this is no like for like speed-up
+    printf("player hull (hull 1, other geometry) traces: %.1f Mq/s, batch %.1f Mq/s, trace/ray time %.2f, batch %.2f\n",
+           count / tTrace * 1e-6, count / tTraceBatch * 1e-6, tTrace / tRay, tTraceBatch / tRayBatch);
+    free(q);
+    free(rq);
+    free(h1);
+    free(h2);
+    free(t);
+    poolDestroy(pool);
+    return same;
+}
+
+static uint64_t mix(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+void benchHullRate(ZigLoadBSP *bsp, int32_t hull, size_t count, uint64_t seed, hullrate_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (bsp->model_cnt == 0 || count == 0)
+        return;
+    tracequery_t *q = malloc(sizeof(tracequery_t) * count);
+    int32_t *c = malloc(sizeof(int32_t) * count);
+    pmtrace_t *t = malloc(sizeof(pmtrace_t) * count);
+    randomQueries(bsp, q, count, hull, seed);
+
+    double t0 = now();
+    for (size_t i = 0; i < count; i++)
+        c[i] = PM_HullPointContents(bsp, bsp->hroot[hull], q[i].start);
+    out->points = count / (now() - t0);
+    t0 = now();
+    for (size_t i = 0; i < count; i++)
+        PM_TraceLine(bsp, hull, q[i].start, q[i].end, t + i);
+    out->traces = count / (now() - t0);
+
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < count; i++) {
+        h = mix(h, c + i, sizeof(c[i]));
+        h = mix(h, &t[i].fraction, sizeof(t[i].fraction));
+        h = mix(h, t[i].endpos, sizeof(t[i].endpos));
+    }
+    out->checksum = h;
+    free(q);
+    free(c);
+    free(t);
+}
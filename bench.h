@@ -0,0 +1,32 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "bsp.h"
+
+// headless benchmarks on a loaded map, they print one line per case
+
+// point contents and traces of every world hull, on the clipnode lumps
+// and on hullnode, count random queries each; false if results differ
+bool benchHull(ZigLoadBSP *bsp, size_t count, uint64_t seed);
+
+// point contents of every world hull through occupancy grids of a few cell
+// sizes against the tree walk, with build time and memory of each grid;
+// threads as for poolCreate; false if results differ
+bool benchGrid(ZigLoadBSP *bsp, size_t count, int threads, uint64_t seed);
+
+// rays on the render nodes, one at a time and batched on the thread pool,
+// next to traces of the same segments through the standing player hull
+// (hroot[0]), which is other geometry, for scale only; also checks every
+// hit against findLeaf just before and after it. false if the batch
+// differs from the single rays
+bool benchRay(ZigLoadBSP *bsp, size_t count, int threads, uint64_t seed);
+
+// throughput of the hull kernels on count seeded random queries of hull,
+// for machine-readable reports; nothing is printed
+typedef struct {
+    double points;     // PM_HullPointContents per second
+    double traces;     // PM_TraceLine, which is PM_RecursiveHullCheck, per second
+    uint64_t checksum; // of contents, fractions and end points, the same for the same map and seed
+} hullrate_t;
+
+void benchHullRate(ZigLoadBSP *bsp, int32_t hull, size_t count, uint64_t seed, hullrate_t *out);
@@ -0,0 +1,334 @@
+#include <string.h>
+#include "bsp.h"
+
+// distance of pos to the plane of h, one load for axial planes; the same
+// as the dot product, the zero terms add nothing
+static inline float hullDist(hullnode_t *h, vec3 pos) {
+    if (h->type != AXIS_ANY)
+        return pos[h->type] - h->d;
+    return glm_vec3_dot(h->n, pos) - h->d;
+}
+
+int32_t traverseBSP(ZigLoadBSP *bsp, int32_t node, float pos[3], float *out_normal) {
+    if (node < 0) {
+        if (out_normal)
+            glm_vec3_zero(out_normal);
+        return node;
+    }
+    while (true) {
+        hullnode_t *h = bsp->hullnode + node;
+        bool side = hullDist(h, pos) > 0.0;
+        if (side)
+            node = h->iChilds[0];
+        else
+            node = h->iChilds[1];
+        if (node < 0) {
+            if (out_normal) {
+                glm_vec3_copy(h->n, out_normal);
+                if (!side)
+                    glm_vec3_negate(out_normal);
+            }
+            return node;
+        }
+    }
+}
+
+int32_t PM_HullPointContents(ZigLoadBSP *bsp, int32_t num, vec3 pos) {
+    while (num >= 0) {
+        hullnode_t *h = bsp->hullnode + num;
+        num = h->iChilds[hullDist(h, pos) < 0];
+    }
+    return num;
+}
+
+// PM_ClipHullCheck on hullnode
+bool PM_RecursiveHullCheck(ZigLoadBSP *hull, int root, int num, float p1f, float p2f, vec3 p1, vec3 p2, pmtrace_t *trace) {
+    hullnode_t *node;
+    float t1, t2;
+    float frac, midf;
+    int side;
+    vec3 mid;
+loc0:
+    // check for empty
+    if (num < 0) {
+        if (num != CONTENTS_SOLID) {
+            trace->allsolid = false;
+            if (num == CONTENTS_EMPTY)
+                trace->inopen = true;
+            else
+                trace->inwater = true;
+        } else
+            trace->startsolid = true;
+        return true; // empty
+    }
+
+    // find the point distances
+    node = hull->hullnode + num;
+    t1 = hullDist(node, p1);
+    t2 = hullDist(node, p2);
+
+    if (t1 >= 0.0f && t2 >= 0.0f) {
+        num = node->iChilds[0];
+        goto loc0;
+    }
+
+    if (t1 < 0.0f && t2 < 0.0f) {
+        num = node->iChilds[1];
+        goto loc0;
+    }
+
+    // put the crosspoint DIST_EPSILON pixels on the near side
+    side = (t1 < 0.0f);
+
+    if (side)
+        frac = (t1 + DIST_EPSILON) / (t1 - t2);
+    else
+        frac = (t1 - DIST_EPSILON) / (t1 - t2);
+
+    if (frac < 0.0f)
+        frac = 0.0f;
+    if (frac > 1.0f)
+        frac = 1.0f;
+
+    midf = p1f + (p2f - p1f) * frac;
+    glm_vec3_lerp(p1, p2, frac, mid);
+
+    // move up to the node
+    if (!PM_RecursiveHullCheck(hull, root, node->iChilds[side], p1f, midf, p1, mid, trace))
+        return false;
+
+    if (PM_HullPointContents(hull, node->iChilds[side ^ 1], mid) != CONTENTS_SOLID) {
+        // go past the node
+        return PM_RecursiveHullCheck(hull, root, node->iChilds[side ^ 1], midf, p2f, mid, p2, trace);
+    }
+
+    // never got out of the solid area
+    if (trace->allsolid)
+        return false;
+
+    // the other side of the node is solid, this is the impact point
+    glm_vec3_copy(node->n, trace->plane.n);
+    trace->plane.d = node->d;
+    if (side) {
+        glm_vec3_negate(trace->plane.n);
+        trace->plane.d = -node->d;
+    }
+
+    while (PM_HullPointContents(hull, root, mid) == CONTENTS_SOLID) {
+        // shouldn't really happen, but does occasionally
+        frac -= 0.1f;
+
+        if (frac < 0.0f) {
+            trace->fraction = midf;
+            glm_vec3_copy(mid, trace->endpos);
+            return false;
+        }
+
+        midf = p1f + (p2f - p1f) * frac;
+        glm_vec3_lerp(p1, p2, frac, mid);
+    }
+
+    trace->fraction = midf;
+    glm_vec3_copy(mid, trace->endpos);
+
+    return false;
+}
+
+// copied from Xash3D, on the clipnode and plane lumps
+
+int32_t PM_ClipPointContents(ZigLoadBSP *bsp, int32_t num, vec3 pos) {
+    while (num >= 0) {
+        clipnode_t c = bsp->clipnode[num];
+        plane_t p = bsp->planes[c.iPlane];
+        num = c.iChilds[glm_vec3_dot(p.n, pos) - p.d < 0];
+    }
+    return num;
+}
+bool PM_ClipHullCheck(ZigLoadBSP *hull, int root, int num, float p1f, float p2f, vec3 p1, vec3 p2, pmtrace_t *trace) {
+    clipnode_t *node;
+    plane_t *plane;
+    float t1, t2;
+    float frac, midf;
+    int side;
+    vec3 mid;
+loc0:
+    // check for empty
+    if (num < 0) {
+        if (num != CONTENTS_SOLID) {
+            trace->allsolid = false;
+            if (num == CONTENTS_EMPTY)
+                trace->inopen = true;
+            else
+                trace->inwater = true;
+        } else
+            trace->startsolid = true;
+        return true; // empty
+    }
+
+    // find the point distances
+    node = hull->clipnode + num;
+    plane = hull->planes + node->iPlane;
+
+    t1 = glm_vec3_dot(p1, plane->n) - plane->d; // PlaneDiff(p1, plane);
+    t2 = glm_vec3_dot(p2, plane->n) - plane->d; // PlaneDiff(p2, plane);
+
+    if (t1 >= 0.0f && t2 >= 0.0f) {
+        num = node->iChilds[0];
+        goto loc0;
+    }
+
+    if (t1 < 0.0f && t2 < 0.0f) {
+        num = node->iChilds[1];
+        goto loc0;
+    }
+
+    // put the crosspoint DIST_EPSILON pixels on the near side
+    side = (t1 < 0.0f);
+
+    if (side)
+        frac = (t1 + DIST_EPSILON) / (t1 - t2);
+    else
+        frac = (t1 - DIST_EPSILON) / (t1 - t2);
+
+    if (frac < 0.0f)
+        frac = 0.0f;
+    if (frac > 1.0f)
+        frac = 1.0f;
+
+    midf = p1f + (p2f - p1f) * frac;
+    glm_vec3_lerp(p1, p2, frac, mid); // VectorLerp(p1, frac, p2, mid);
+
+    // move up to the node
+    if (!PM_ClipHullCheck(hull, root, node->iChilds[side], p1f, midf, p1, mid, trace))
+        return false;
+
+    // this recursion can not be optimized because mid would need to be duplicated on a stack
+    if (PM_ClipPointContents(hull, node->iChilds[side ^ 1], mid) != CONTENTS_SOLID) {
+        // go past the node
+        return PM_ClipHullCheck(hull, root, node->iChilds[side ^ 1], midf, p2f, mid, p2, trace);
+    }
+
+    // never got out of the solid area
+    if (trace->allsolid)
+        return false;
+
+    // the other side of the node is solid, this is the impact point
+    if (!side) {
+        glm_vec3_copy(plane->n, trace->plane.n);
+        trace->plane.d = plane->d;
+    } else {
+        glm_vec3_copy(plane->n, trace->plane.n);
+        glm_vec3_negate(trace->plane.n);
+        trace->plane.d = -plane->d;
+    }
+
+    while (PM_ClipPointContents(hull, root, mid) == CONTENTS_SOLID) {
+        // shouldn't really happen, but does occasionally
+        frac -= 0.1f;
+
+        if (frac < 0.0f) {
+            trace->fraction = midf;
+            glm_vec3_copy(mid, trace->endpos);
+            // fprintf(stderr, "trace backed up past 0.0\n");
+            return false;
+        }
+
+        midf = p1f + (p2f - p1f) * frac;
+        glm_vec3_lerp(p1, p2, frac, mid); // VectorLerp(p1, frac, p2, mid);
+    }
+
+    trace->fraction = midf;
+    glm_vec3_copy(mid, trace->endpos);
+
+    return false;
+}
+
+// PVS
+
+int32_t findLeaf(ZigLoadBSP *bsp, vec3 pos) {
+    int32_t node = bsp->headnode;
+    while (node >= 0) {
+        node_t *n = bsp->nodes + node;
+        plane_t *p = bsp->planes + n->iPlane;
+        node = n->iChilds[glm_vec3_dot(p->n, pos) - p->d <= 0];
+    }
+    return ~node;
+}
+
+// bit (i - 1) of out is leaf i, leaf 0 is the shared solid leaf
+void decompressVis(ZigLoadBSP *bsp, int32_t leaf, uint8_t *out) {
+    size_t row = (bsp->visleafs + 7) >> 3;
+    int32_t ofs = bsp->leaves[leaf].visOffset;
+    if (leaf == 0 || ofs < 0 || (size_t)ofs >= bsp->vis_size) {
+        memset(out, 0xFF, row);
+        return;
+    }
+    const uint8_t *in = bsp->visdata + ofs;
+    const uint8_t *end = bsp->visdata + bsp->vis_size;
+    size_t o = 0;
+    while (o < row && in < end) {
+        if (*in) {
+            out[o++] = *in++;
+            continue;
+        }
+        if (in + 1 >= end)
+            break;
+        size_t c = in[1];
+        in += 2;
+        while (c-- && o < row)
+            out[o++] = 0;
+    }
+    memset(out + o, 0, row - o);
+}
+
+// batched queries
+
+void PM_TraceFrom(ZigLoadBSP *bsp, int32_t hull, int32_t num, vec3 start, vec3 end, pmtrace_t *trace) {
+    memset(trace, 0, sizeof(*trace));
+    trace->fraction = 1.0f;
+    trace->allsolid = true;
+    glm_vec3_copy(end, trace->endpos);
+    PM_RecursiveHullCheck(bsp, bsp->hroot[hull], num, 0.0f, 1.0f, start, end, trace);
+    if (trace->allsolid)
+        trace->startsolid = true;
+    if (trace->startsolid)
+        trace->fraction = 0.0f;
+}
+
+void PM_TraceLine(ZigLoadBSP *bsp, int32_t hull, vec3 start, vec3 end, pmtrace_t *trace) {
+    PM_TraceFrom(bsp, hull, bsp->hroot[hull], start, end, trace);
+}
+
+typedef struct {
+    ZigLoadBSP *bsp;
+    const void *queries;
+    void *results;
+} batch_t;
+
+static void traceChunk(void *ctx, size_t begin, size_t end) {
+    batch_t *b = ctx;
+    const tracequery_t *q = b->queries;
+    pmtrace_t *r = b->results;
+    for (size_t i = begin; i < end; i++) {
+        PM_TraceLine(b->bsp, q[i].hull, (float *)q[i].start, (float *)q[i].end, r + i);
+    }
+}
+
+void PM_TraceBatch(pool_t *pool, ZigLoadBSP *bsp, const tracequery_t *queries, pmtrace_t *results, size_t count) {
+    batch_t b = {bsp, queries, results};
+    poolFor(pool, count, 256, traceChunk, &b);
+}
+
+static void pointChunk(void *ctx, size_t begin, size_t end) {
+    batch_t *b = ctx;
+    const pointquery_t *q = b->queries;
+    int32_t *r = b->results;
+    for (size_t i = begin; i < end; i++) {
+        r[i] = PM_HullPointContents(b->bsp, b->bsp->hroot[q[i].hull], (float *)q[i].pos);
+    }
+}
+
+void PM_PointContentsBatch(pool_t *pool, ZigLoadBSP *bsp, const pointquery_t *queries, int32_t *results, size_t count) {
+    batch_t b = {bsp, queries, results};
+    poolFor(pool, count, 1024, pointChunk, &b);
+}
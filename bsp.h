@@ -0,0 +1,282 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <cglm/cglm.h>
+#include "pool.h"
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t i3Index0;
+    uint32_t n3Indexs;
+    uint8_t (*pixels)[4]; // 4 mip levels, each (width >> l) * (height >> l), NULL if in a wad
+    uint8_t skipped;
+    uint8_t alpha;   // some texels are keyed out: alpha-tested, else opaque
+    uint16_t texarr; // index into ZigLoadBSP.texarrs
+    uint16_t layer;  // layer in that array
+    uint32_t iVertex0; // base vertex of the indices
+    uint8_t *indexs;   // TEX_INDEX instead of pixels: palette indices, laid out like pixels
+} ZigBSPTex;
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t layers; // at most 256
+} ZigBSPTexArr;
+
+typedef struct {
+    vec3 n;
+    float d;
+    int32_t type;
+} plane_t;
+
+typedef struct {
+    uint32_t iPlane;
+    int16_t iChilds[2];
+} clipnode_t;
+
+#define AXIS_ANY 3
+
+// clipnode with its plane, see hullopt.zig
+typedef struct {
+    vec3 n;
+    float d;
+    int32_t iChilds[2]; // if neg: contents
+    uint32_t type;      // 0, 1, 2: n is the x, y or z axis, else AXIS_ANY
+    uint32_t pad;
+} hullnode_t;
+
+typedef struct {
+    uint32_t iPlane;
+    int16_t iChilds[2]; // if neg: ~i is index into leaf
+    int16_t mins[3];
+    int16_t maxs[3];
+    uint16_t iFace0;
+    uint16_t nFaces;
+} node_t;
+
+typedef struct {
+    int32_t contents;
+    int32_t visOffset; // -1: no visibility info
+    int16_t mins[3];
+    int16_t maxs[3];
+    uint16_t iMarkSurface0;
+    uint16_t nMarkSurfaces;
+    uint8_t ambientLevels[4];
+} leaf_t;
+
+typedef struct {
+    uint32_t i3Index0;
+    uint32_t n3Indexs;
+    uint32_t iTexture;
+} facedraw_t;
+
+typedef struct {
+    int16_t mins[3];
+    int16_t maxs[3];
+    uint32_t iFace0;
+    uint32_t nFaces;
+    uint32_t iRange0; // into ZigLoadBSP.ranges, one per texture
+    uint32_t nRanges;
+    uint8_t dropped; // trigger or invisible entity, faces not loaded
+} ZigBSPModel;
+
+enum { VTX_FLOAT, VTX_QUANT };
+
+enum { TEX_RGBA, TEX_INDEX };
+
+typedef struct {
+    float pos[3];
+    float tex[2];
+    float lm[2]; // in the lightmap atlas, 0 to 1
+} vertex_t; // VTX_FLOAT
+
+typedef struct {
+    int16_t pos[3]; // in steps of ZigLoadBSP.pos_scale
+    int16_t pad;
+    uint16_t tex[2]; // half floats
+    uint16_t lm[2];  // normalized
+} vertexq_t; // VTX_QUANT
+
+typedef struct {
+    uint8_t compact; // weld and quantize vertices, default 1
+    uint8_t reorder; // order faces for the vertex cache, with compact, default 0
+    uint8_t relayout; // world hull nodes in van Emde Boas order, default 1
+    uint8_t threads;  // loader threads, 0: one per core (default), same result for any
+    uint8_t paletted; // textures as indices and palettes instead of rgba, default 0
+} ZigLoadOptions;
+
+struct hullgrid;
+
+typedef struct {
+    uint8_t *vbo_data;
+    size_t vbo_size;
+    uint8_t *ebo_data;
+    size_t ebo_size;
+    ZigBSPTex *textures;
+    size_t text_cnt;
+    clipnode_t *clipnode;
+    size_t clip_cnt;
+    int32_t hull[3];
+    plane_t *planes;
+    size_t planecnt;
+    int32_t headnode;
+    node_t *nodes;
+    size_t nodecnt;
+    leaf_t *leaves;
+    size_t leafcnt;
+    size_t visleafs;
+    uint16_t *marksurf;
+    size_t markcnt;
+    uint8_t *visdata;
+    size_t vis_size;
+    facedraw_t *facedraw;
+    size_t face_cnt;
+    size_t world_nf; // faces [0, world_nf) belong to the world, rest to brush models
+    const void *mapping; // if not NULL, lump arrays point into this mapping of the file
+    size_t map_size;
+    ZigBSPTexArr *texarrs;
+    size_t tarr_cnt;
+    uint8_t cached; // everything is in the mapping of a map cache file
+    uint8_t vtx_fmt;  // VTX_FLOAT or VTX_QUANT
+    uint8_t idx_size; // 2 or 4, indices are relative to ZigBSPTex.iVertex0
+    uint8_t tex_fmt;  // TEX_RGBA: ZigBSPTex.pixels, TEX_INDEX: indexs and palettes
+    float pos_scale;  // world units per step of vertexq_t.pos
+    ZigBSPModel *models; // models[0] is the world
+    size_t model_cnt;
+    facedraw_t *ranges; // index ranges of the models
+    size_t range_cnt;
+    hullnode_t *hullnode; // the world hulls, for the traces
+    size_t hnode_cnt;
+    int32_t hroot[3]; // roots of hull[] in hullnode
+    uint8_t (*palettes)[256][4]; // TEX_INDEX: keyed rgba palette per texture
+    size_t pal_cnt;
+    uint8_t (*lightmap)[3]; // atlas of the first light style of every face, rgb
+    size_t lm_size;         // lm_width * lm_height
+    uint32_t lm_width;
+    uint32_t lm_height;
+    struct hullgrid *grids; // one per hroot, see PM_GridAttach, NULL if none
+} ZigLoadBSP;
+
+typedef struct {
+    bool allsolid;
+    bool startsolid;
+    bool inopen, inwater;
+    float fraction;
+    vec3 endpos;
+    plane_t plane;
+    int ent;
+    vec3 deltavelocity;
+    int hitgroup;
+} pmtrace_t;
+
+// #define DIST_EPS (1.0f / 32.0f)
+#define DIST_EPSILON FLT_EPSILON
+#define CONTENTS_EMPTY -1
+#define CONTENTS_SOLID -2
+#define CONTENTS_SKY -6
+
+// loadbsp.zig
+extern ZigLoadOptions zigLoadOptions;
+int32_t zigLoadBSP(const char *filename, ZigLoadBSP *result);
+int32_t zigMapBSP(const char *filename, ZigLoadBSP *result); // zero-copy, read-only lumps
+int32_t zigLoadBSPCached(const char *filename, ZigLoadBSP *result); // through filename.cache
+void zigFreeBSP(ZigLoadBSP *result);
+
+// these walk hullnode, num and root are hullnode indices such as hroot[i]
+int32_t traverseBSP(ZigLoadBSP *bsp, int32_t node, float pos[3], float *out_normal);
+int32_t PM_HullPointContents(ZigLoadBSP *bsp, int32_t num, vec3 pos);
+bool PM_RecursiveHullCheck(ZigLoadBSP *hull, int root, int num, float p1f, float p2f, vec3 p1, vec3 p2, pmtrace_t *trace);
+// the same on the clipnode and plane lumps, num and root are clipnode
+// indices such as hull[i], for any model
+int32_t PM_ClipPointContents(ZigLoadBSP *bsp, int32_t num, vec3 pos);
+bool PM_ClipHullCheck(ZigLoadBSP *hull, int root, int num, float p1f, float p2f, vec3 p1, vec3 p2, pmtrace_t *trace);
+int32_t findLeaf(ZigLoadBSP *bsp, vec3 pos);
+void decompressVis(ZigLoadBSP *bsp, int32_t leaf, uint8_t *out);
+
+// batched queries, hull is 0, 1 or 2, the index into ZigLoadBSP.hroot
+// run on the calling thread if pool is NULL
+
+typedef struct {
+    vec3 start;
+    vec3 end;
+    int32_t hull;
+} tracequery_t;
+
+typedef struct {
+    vec3 pos;
+    int32_t hull;
+} pointquery_t;
+
+void PM_TraceLine(ZigLoadBSP *bsp, int32_t hull, vec3 start, vec3 end, pmtrace_t *trace);
+// same as PM_TraceLine, but start at node num, which both start and end reach from the hull root
+void PM_TraceFrom(ZigLoadBSP *bsp, int32_t hull, int32_t num, vec3 start, vec3 end, pmtrace_t *trace);
+void PM_TraceBatch(pool_t *pool, ZigLoadBSP *bsp, const tracequery_t *queries, pmtrace_t *results, size_t count);
+void PM_PointContentsBatch(pool_t *pool, ZigLoadBSP *bsp, const pointquery_t *queries, int32_t *results, size_t count);
+
+// packet traversal: consecutive queries with the same hull go down the tree
+// together, classified against each node in one SIMD step, and split only
+// where the lanes disagree. results are bit-identical to the batches above
+
+typedef enum {
+    PACKET_SCALAR = 1,
+    PACKET_SSE = 4,
+    PACKET_AVX2 = 8,
+} packetmode_t;
+
+packetmode_t PM_PacketMode(void); // widest supported by the cpu
+void PM_TraceBatchPacked(pool_t *pool, ZigLoadBSP *bsp, const tracequery_t *queries, pmtrace_t *results, size_t count, packetmode_t mode);
+void PM_PointContentsBatchPacked(pool_t *pool, ZigLoadBSP *bsp, const pointquery_t *queries, int32_t *results, size_t count, packetmode_t mode);
+
+// occupancy grid of a world hull: cubic cells in bricks of 4x4x4, a brick
+// that is all one contents stores only that, else every cell stores its
+// contents or the deepest node all of its points go through, where the
+// walk starts. queries are exactly those of PM_HullPointContents
+
+typedef struct hullgrid {
+    int32_t root;    // hull root in hullnode
+    vec3 origin;     // corner of cell 0
+    float cell;      // cell edge
+    float inv;       // 1 / cell
+    int32_t dims[3]; // in bricks
+    int32_t *top;    // per brick: contents if negative, else offset of its cells
+    int32_t *cells;  // 64 per mixed brick, x fastest: contents if negative, else hullnode index
+    size_t nBricks;
+    size_t nMixed;       // bricks with cells
+    size_t uniformCells; // cells that need no walk
+    size_t bytes;        // of top and cells
+} hullgrid_t;
+
+// hull is 0, 1 or 2, the grid covers the world model bounds; false if
+// out of memory, the grid is empty then and queries walk the tree
+bool PM_GridBuild(pool_t *pool, ZigLoadBSP *bsp, int32_t hull, float cell, hullgrid_t *grid);
+void PM_GridFree(hullgrid_t *grid);
+int32_t PM_GridPointContents(ZigLoadBSP *bsp, const hullgrid_t *grid, vec3 pos);
+// grids of all three hulls, owned by bsp until PM_GridDetach, which has to
+// come before zigFreeBSP; false if out of memory, bsp has none then
+bool PM_GridAttach(pool_t *pool, ZigLoadBSP *bsp, float cell);
+void PM_GridDetach(ZigLoadBSP *bsp);
+// PM_HullPointContents from the root of hull, through its grid if attached
+int32_t PM_PointContents(ZigLoadBSP *bsp, int32_t hull, vec3 pos);
+
+// rays on the render nodes and leaves, headnode down: hitscan, the ray
+// stops at the first solid or sky leaf; see ray.c. unlike findLeaf, a
+// point on a plane is on the side the ray goes to
+
+typedef struct {
+    vec3 start;
+    vec3 end;
+} rayquery_t;
+
+typedef struct {
+    float fraction;   // on the plane it hit, 1 if nothing was hit
+    int32_t contents; // of the leaf it stopped in, or of the one end is in
+    int32_t leaf;     // index into ZigLoadBSP.leaves, like contents
+    bool startsolid;  // fraction 0, plane zero
+    vec3 endpos;
+    plane_t plane; // facing start
+} rayhit_t;
+
+void rayCast(ZigLoadBSP *bsp, vec3 start, vec3 end, rayhit_t *hit);
+void rayCastBatch(pool_t *pool, ZigLoadBSP *bsp, const rayquery_t *queries, rayhit_t *hits, size_t count);
@@ -2,10 +2,29 @@
 
 set -ue
 
-zig build-obj -fsingle-threaded -lc -OReleaseFast -fstrip loadbsp.zig
+CFLAGS="-Wall -Wextra -Wpedantic -std=c11 -Wno-unused-parameter -Ofast"
 
-gcc -Wall -Wextra -Wpedantic -std=c11 -Wno-unused-parameter \
-    $(pkg-config --cflags --libs glfw3 glew cglm) -lm \
-    loadbsp.o main.c -Ofast -flto
+zig build-obj -lc -OReleaseFast -fstrip loadbsp.zig
 
-rm *.o
+# headless library: loader, traces, rays, movement, thread pool and benchmarks, no GL
+gcc $CFLAGS $(pkg-config --cflags cglm) -c pool.c player.c bench.c ray.c
+# the packets and the grid promise the results of the scalar walks to
+# the bit, which needs plain IEEE math in all three
+gcc $CFLAGS -fno-fast-math -ffp-contract=off $(pkg-config --cflags cglm) -c bsp.c packet.c grid.c
+ar rcs libhlbsp.a loadbsp.o bsp.o pool.o packet.o player.o bench.o grid.o ray.o
+
+# shaders go into the binary as string literals
+for s in v f; do
+    printf 'static const char %sShaderSrc[] =\n' $s
+    sed 's/\\/\\\\/g; s/"/\\"/g; s/^/    "/; s/$/\\n"/' $s.glsl
+    echo ';'
+done > shaders.h
+
+gcc $CFLAGS main.c demo.c server.c sim.c prof.c mapload.c render.c shader.c libhlbsp.a \
+    $(pkg-config --cflags --libs glfw3 glew cglm) -lm -pthread -flto
+
+# benchmark, renders offscreen through EGL, no window system needed
+gcc $CFLAGS hlbench.c prof.c mapload.c render.c shader.c libhlbsp.a \
+    $(pkg-config --cflags --libs egl glew cglm) -lm -pthread -flto -o hlbench
+
+rm *.o shaders.h
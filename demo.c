@@ -0,0 +1,98 @@
+#include <string.h>
+#include "demo.h"
+
+#define DEMO_VERSION 1
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t tickrate;
+    uint32_t ticks;
+} demohdr_t;
+
+// one cmd for repeat ticks
+typedef struct {
+    float yaw, pitch;
+    uint16_t buttons;
+    uint16_t repeat;
+} demorun_t;
+
+static bool sameCmd(const usercmd_t *a, const usercmd_t *b) {
+    return a->yaw == b->yaw && a->pitch == b->pitch && a->buttons == b->buttons;
+}
+
+static void flushRun(demo_t *demo) {
+    if (demo->repeat == 0)
+        return;
+    demorun_t run = {demo->cmd.yaw, demo->cmd.pitch, demo->cmd.buttons, demo->repeat};
+    fwrite(&run, sizeof(run), 1, demo->fp);
+    demo->repeat = 0;
+}
+
+bool demoRecord(demo_t *demo, const char *filename, uint32_t tickrate) {
+    memset(demo, 0, sizeof(*demo));
+    if (!(demo->fp = fopen(filename, "wb")))
+        return false;
+    demo->write = true;
+    demo->tickrate = tickrate;
+    demohdr_t hdr = {{'H', 'L', 'D', 'M'}, DEMO_VERSION, tickrate, 0};
+    fwrite(&hdr, sizeof(hdr), 1, demo->fp);
+    return true;
+}
+
+void demoWrite(demo_t *demo, const usercmd_t *cmd) {
+    if (demo->repeat > 0 && (demo->repeat == UINT16_MAX || !sameCmd(&demo->cmd, cmd)))
+        flushRun(demo);
+    demo->cmd = *cmd;
+    demo->repeat++;
+    demo->ticks++;
+}
+
+bool demoClose(demo_t *demo, float pos[3], float vel[3]) {
+    bool ok = true;
+    if (demo->write) {
+        flushRun(demo);
+        fwrite(pos, sizeof(float[3]), 1, demo->fp);
+        fwrite(vel, sizeof(float[3]), 1, demo->fp);
+        demohdr_t hdr = {{'H', 'L', 'D', 'M'}, DEMO_VERSION, demo->tickrate, demo->ticks};
+        fseek(demo->fp, 0, SEEK_SET);
+        fwrite(&hdr, sizeof(hdr), 1, demo->fp);
+    } else {
+        ok = fread(pos, sizeof(float[3]), 1, demo->fp) == 1 && fread(vel, sizeof(float[3]), 1, demo->fp) == 1;
+    }
+    fclose(demo->fp);
+    demo->fp = NULL;
+    return ok;
+}
+
+bool demoPlay(demo_t *demo, const char *filename) {
+    memset(demo, 0, sizeof(*demo));
+    if (!(demo->fp = fopen(filename, "rb")))
+        return false;
+    demohdr_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, demo->fp) != 1 || memcmp(hdr.magic, "HLDM", 4) != 0 ||
+        hdr.version != DEMO_VERSION || hdr.tickrate == 0) {
+        fclose(demo->fp);
+        demo->fp = NULL;
+        return false;
+    }
+    demo->tickrate = hdr.tickrate;
+    demo->ticks = hdr.ticks;
+    return true;
+}
+
+bool demoRead(demo_t *demo, usercmd_t *cmd) {
+    if (demo->played == demo->ticks)
+        return false;
+    if (demo->repeat == 0) {
+        demorun_t run;
+        if (fread(&run, sizeof(run), 1, demo->fp) != 1 || run.repeat == 0)
+            return false;
+        demo->cmd = (usercmd_t){run.yaw, run.pitch, run.buttons};
+        demo->repeat = run.repeat;
+    }
+    demo->repeat--;
+    demo->played++;
+    *cmd = demo->cmd;
+    return true;
+}
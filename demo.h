@@ -0,0 +1,26 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "player.h"
+
+// demo file: header, runs of equal usercmds, then the final state to
+// check a replay against; a demo starts from the initial player state
+
+typedef struct {
+    FILE *fp;
+    bool write;
+    uint32_t tickrate;
+    uint32_t ticks; // recorded, or to play
+    uint32_t played;
+    usercmd_t cmd;   // being repeated
+    uint32_t repeat; // record: times cmd was written, play: times left
+} demo_t;
+
+bool demoRecord(demo_t *demo, const char *filename, uint32_t tickrate);
+void demoWrite(demo_t *demo, const usercmd_t *cmd);
+// record: writes the final state, play: reads it, false if there is none
+bool demoClose(demo_t *demo, float pos[3], float vel[3]);
+
+bool demoPlay(demo_t *demo, const char *filename);
+bool demoRead(demo_t *demo, usercmd_t *cmd); // false at the end
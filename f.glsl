@@ -1,11 +1,29 @@
-#version 330 core
-
+#ifdef TEXARRAY
+in vec3 texCoord;
+uniform sampler2DArray tex;
+#else
 in vec2 texCoord;
 uniform sampler2D tex;
+#endif
+// the lightmap atlas, the same for every texture
+uniform sampler2D lightmap;
+in vec2 lmCoord;
+#ifdef PALETTE
+// tex holds palette indices, row palRow of pal is their keyed rgba palette
+uniform sampler2D pal;
+flat in float palRow;
+#endif
 
 void main() {
+#ifdef PALETTE
+  float index = texture(tex, texCoord).r;
+  vec4 color = texelFetch(pal, ivec2(int(index * 255.0 + 0.5), int(palRow)), 0);
+#else
   vec4 color = texture(tex, texCoord);
+#endif
+#ifdef ALPHATEST
   if (color.w < 0.5)
     discard;
-  gl_FragColor = color;
-}
\ No newline at end of file
+#endif
+  gl_FragColor = vec4(color.rgb * texture(lightmap, lmCoord).rgb, color.a);
+}
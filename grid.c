@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "bsp.h"
+
+// cells of a brick per axis, a brick is GRID_BRICK^3 cells
+#define GRID_BRICK 4
+#define BRICK_CELLS (GRID_BRICK * GRID_BRICK * GRID_BRICK)
+// a box is on one side of a plane only if it is this far from it, which
+// covers rounding of the distances and of pos to a cell
+#define GRID_EPS (1.0f / 16.0f)
+// a box that crosses more planes than this is taken as mixed
+#define GRID_SPLITS 64
+#define MIXED 1
+
+typedef enum { SIDE_FRONT, SIDE_BACK, SIDE_BOTH } side_t;
+
+static side_t boxSide(hullnode_t *h, vec3 center, vec3 half) {
+    float dc = glm_vec3_dot(h->n, center) - h->d;
+    float r = fabsf(h->n[0]) * half[0] + fabsf(h->n[1]) * half[1] + fabsf(h->n[2]) * half[2] + GRID_EPS;
+    if (dc - r >= 0.0f)
+        return SIDE_FRONT;
+    if (dc + r < 0.0f)
+        return SIDE_BACK;
+    return SIDE_BOTH;
+}
+
+// deepest node that every point of the box goes through, or contents
+static int32_t boxStart(ZigLoadBSP *bsp, int32_t num, vec3 center, vec3 half) {
+    while (num >= 0) {
+        hullnode_t *h = bsp->hullnode + num;
+        side_t s = boxSide(h, center, half);
+        if (s == SIDE_BOTH)
+            break;
+        num = h->iChilds[s];
+    }
+    return num;
+}
+
+// contents of the whole box, or MIXED
+static int32_t boxContents(ZigLoadBSP *bsp, int32_t num, vec3 center, vec3 half, int *splits) {
+    while (num >= 0) {
+        hullnode_t *h = bsp->hullnode + num;
+        side_t s = boxSide(h, center, half);
+        if (s != SIDE_BOTH) {
+            num = h->iChilds[s];
+            continue;
+        }
+        if (++*splits > GRID_SPLITS)
+            return MIXED;
+        int32_t a = boxContents(bsp, h->iChilds[0], center, half, splits);
+        if (a == MIXED)
+            return MIXED;
+        return a == boxContents(bsp, h->iChilds[1], center, half, splits) ? a : MIXED;
+    }
+    return num;
+}
+
+// what a box stores: its contents if uniform, else where to start walking
+static int32_t classify(ZigLoadBSP *bsp, int32_t root, vec3 center, vec3 half) {
+    int32_t start = boxStart(bsp, root, center, half);
+    int splits = 0;
+    int32_t c = boxContents(bsp, start, center, half, &splits);
+    return c == MIXED ? start : c;
+}
+
+typedef struct {
+    ZigLoadBSP *bsp;
+    hullgrid_t *grid;
+    int32_t *mixed; // brick of every mixed brick
+    int32_t *start; // and the node its cells start from
+} gridbuild_t;
+
+static void brickCorner(const hullgrid_t *g, size_t b, vec3 lo) {
+    float bs = g->cell * GRID_BRICK;
+    int32_t bx = b % g->dims[0], by = b / g->dims[0] % g->dims[1], bz = b / g->dims[0] / g->dims[1];
+    glm_vec3_copy((vec3){g->origin[0] + bx * bs, g->origin[1] + by * bs, g->origin[2] + bz * bs}, lo);
+}
+
+// pass 1: top of every brick, its contents or, if mixed, its start node
+static void classifyBricks(void *ctx, size_t begin, size_t end) {
+    gridbuild_t *gb = ctx;
+    hullgrid_t *g = gb->grid;
+    float bs = g->cell * GRID_BRICK;
+    vec3 brickHalf = {bs / 2, bs / 2, bs / 2};
+    for (size_t b = begin; b < end; b++) {
+        vec3 lo, center;
+        brickCorner(g, b, lo);
+        glm_vec3_add(lo, brickHalf, center);
+        g->top[b] = classify(gb->bsp, g->root, center, brickHalf);
+    }
+}
+
+// pass 2: the cells of mixed brick m, each on its own from the brick's node
+static void buildCells(void *ctx, size_t begin, size_t end) {
+    gridbuild_t *gb = ctx;
+    hullgrid_t *g = gb->grid;
+    float s = g->cell;
+    vec3 cellHalf = {s / 2, s / 2, s / 2};
+    for (size_t m = begin; m < end; m++) {
+        vec3 lo;
+        brickCorner(g, gb->mixed[m], lo);
+        int32_t *out = g->cells + m * BRICK_CELLS;
+        for (int k = 0; k < BRICK_CELLS; k++) {
+            int x = k % GRID_BRICK, y = k / GRID_BRICK % GRID_BRICK, z = k / GRID_BRICK / GRID_BRICK;
+            vec3 cc = {lo[0] + (x + 0.5f) * s, lo[1] + (y + 0.5f) * s, lo[2] + (z + 0.5f) * s};
+            out[k] = classify(gb->bsp, gb->start[m], cc, cellHalf);
+        }
+    }
+}
+
+bool PM_GridBuild(pool_t *pool, ZigLoadBSP *bsp, int32_t hull, float cell, hullgrid_t *grid) {
+    memset(grid, 0, sizeof(*grid));
+    grid->root = bsp->hroot[hull];
+    grid->cell = cell;
+    grid->inv = 1.0f / cell;
+    if (bsp->model_cnt == 0)
+        return true;
+    ZigBSPModel *world = bsp->models;
+    float bs = cell * GRID_BRICK;
+    size_t nBricks = 1;
+    for (int k = 0; k < 3; k++) {
+        grid->origin[k] = world->mins[k] - cell;
+        grid->dims[k] = (int32_t)ceilf((world->maxs[k] + cell - grid->origin[k]) / bs);
+        nBricks *= grid->dims[k];
+    }
+    grid->top = malloc(sizeof(int32_t) * nBricks);
+    if (!grid->top) {
+        PM_GridFree(grid);
+        return false;
+    }
+    gridbuild_t gb = {bsp, grid, NULL, NULL};
+    poolFor(pool, nBricks, 16, classifyBricks, &gb);
+
+    // only mixed bricks get cells, top points at them
+    size_t nMixed = 0;
+    for (size_t b = 0; b < nBricks; b++)
+        nMixed += grid->top[b] >= 0;
+    gb.mixed = malloc(sizeof(int32_t) * (nMixed ? nMixed : 1));
+    gb.start = malloc(sizeof(int32_t) * (nMixed ? nMixed : 1));
+    grid->cells = malloc(sizeof(int32_t) * BRICK_CELLS * (nMixed ? nMixed : 1));
+    if (!gb.mixed || !gb.start || !grid->cells) {
+        free(gb.mixed);
+        free(gb.start);
+        PM_GridFree(grid);
+        return false;
+    }
+    size_t m = 0;
+    for (size_t b = 0; b < nBricks; b++) {
+        if (grid->top[b] < 0)
+            continue;
+        gb.mixed[m] = b;
+        gb.start[m] = grid->top[b];
+        grid->top[b] = m * BRICK_CELLS;
+        m++;
+    }
+    poolFor(pool, nMixed, 4, buildCells, &gb);
+    free(gb.mixed);
+    free(gb.start);
+
+    for (size_t k = 0; k < BRICK_CELLS * nMixed; k++)
+        grid->uniformCells += grid->cells[k] < 0;
+    grid->nBricks = nBricks;
+    grid->nMixed = nMixed;
+    grid->uniformCells += (nBricks - nMixed) * BRICK_CELLS;
+    grid->bytes = sizeof(int32_t) * (nBricks + BRICK_CELLS * nMixed);
+    return true;
+}
+
+void PM_GridFree(hullgrid_t *grid) {
+    free(grid->top);
+    free(grid->cells);
+    memset(grid, 0, sizeof(*grid));
+}
+
+int32_t PM_GridPointContents(ZigLoadBSP *bsp, const hullgrid_t *grid, vec3 pos) {
+    float f[3];
+    int32_t c[3];
+    for (int k = 0; k < 3; k++) {
+        f[k] = (pos[k] - grid->origin[k]) * grid->inv;
+        // also false for NaN
+        if (!(f[k] >= 0.0f && f[k] < (float)(grid->dims[k] * GRID_BRICK)))
+            return PM_HullPointContents(bsp, grid->root, pos);
+        c[k] = (int32_t)f[k];
+    }
+    int32_t b = grid->top[(c[2] / GRID_BRICK * grid->dims[1] + c[1] / GRID_BRICK) * grid->dims[0] + c[0] / GRID_BRICK];
+    if (b < 0)
+        return b;
+    int32_t v = grid->cells[b + ((c[2] % GRID_BRICK) * GRID_BRICK + c[1] % GRID_BRICK) * GRID_BRICK + c[0] % GRID_BRICK];
+    if (v < 0)
+        return v;
+    return PM_HullPointContents(bsp, v, pos);
+}
+
+bool PM_GridAttach(pool_t *pool, ZigLoadBSP *bsp, float cell) {
+    hullgrid_t *grids = calloc(3, sizeof(hullgrid_t));
+    if (!grids)
+        return false;
+    for (int32_t h = 0; h < 3; h++) {
+        if (!PM_GridBuild(pool, bsp, h, cell, grids + h)) {
+            for (int32_t k = 0; k < h; k++)
+                PM_GridFree(grids + k);
+            free(grids);
+            return false;
+        }
+    }
+    bsp->grids = grids;
+    return true;
+}
+
+void PM_GridDetach(ZigLoadBSP *bsp) {
+    if (!bsp->grids)
+        return;
+    for (int32_t h = 0; h < 3; h++)
+        PM_GridFree(bsp->grids + h);
+    free(bsp->grids);
+    bsp->grids = NULL;
+}
+
+int32_t PM_PointContents(ZigLoadBSP *bsp, int32_t hull, vec3 pos) {
+    if (bsp->grids)
+        return PM_GridPointContents(bsp, bsp->grids + hull, pos);
+    return PM_HullPointContents(bsp, bsp->hroot[hull], pos);
+}
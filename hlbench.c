@@ -0,0 +1,335 @@
+// hlbench: load time and peak memory, hull query throughput and offscreen
+// frame times for a corpus of maps, one JSON object per map and line on
+// stdout, so runs can be diffed; logs of the loader go to stderr
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "bsp.h"
+#include "bench.h"
+#include "prof.h"
+#include "mapload.h"
+#include "render.h"
+
+// views from random empty points of the map, drawn in turn
+#define VIEWS 16
+
+typedef struct {
+    size_t queries;
+    uint64_t seed;
+    int frames;
+    int width, height;
+    bool render;
+    bool prepass;
+} options_t;
+
+typedef struct {
+    EGLDisplay dpy;
+    EGLSurface surf;
+    EGLContext ctx;
+} offscreen_t;
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static float randf(uint64_t *s) {
+    return (xorshift(s) >> 40) * (1.0f / (1 << 24));
+}
+
+// kB of a field of /proc/self/status such as "VmHWM:", -1 if there is none
+static long procStatus(const char *field) {
+    FILE *fp = fopen("/proc/self/status", "r");
+    if (!fp)
+        return -1;
+    char line[256];
+    long kb = -1;
+    size_t len = strlen(field);
+    while (fgets(line, sizeof(line), fp))
+        if (strncmp(line, field, len) == 0) {
+            kb = strtol(line + len, NULL, 10);
+            break;
+        }
+    fclose(fp);
+    return kb;
+}
+
+// start VmHWM again from the current rss, so every map has its own peak
+static bool resetPeak(void) {
+    FILE *fp = fopen("/proc/self/clear_refs", "w");
+    if (!fp)
+        return false;
+    bool ok = fputs("5", fp) >= 0;
+    return fclose(fp) == 0 && ok;
+}
+
+static void jsonString(const char *s) {
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// Mesa's surfaceless platform needs no X11 or Wayland server, which the
+// default display may try to open; that one is the fallback
+static EGLDisplay offscreenDisplay(EGLint *major, EGLint *minor, const char **platform) {
+    const char *ext = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (ext && strstr(ext, "EGL_MESA_platform_surfaceless") && getPlatformDisplay) {
+        EGLDisplay dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (dpy != EGL_NO_DISPLAY && eglInitialize(dpy, major, minor)) {
+            *platform = "surfaceless";
+            return dpy;
+        }
+    }
+    EGLDisplay dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (dpy == EGL_NO_DISPLAY || !eglInitialize(dpy, major, minor))
+        return EGL_NO_DISPLAY;
+    *platform = "default";
+    return dpy;
+}
+
+// GL 3.3 core on a pbuffer, no window system needed
+static bool offscreenInit(offscreen_t *o, int width, int height) {
+    memset(o, 0, sizeof(*o));
+    EGLint major, minor, n = 0;
+    const char *platform = NULL;
+    o->dpy = offscreenDisplay(&major, &minor, &platform);
+    if (o->dpy == EGL_NO_DISPLAY)
+        return false;
+    const EGLint cfgAttrs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE,
+    };
+    EGLConfig cfg;
+    if (!eglChooseConfig(o->dpy, cfgAttrs, &cfg, 1, &n) || n == 0 || !eglBindAPI(EGL_OPENGL_API))
+        return false;
+    const EGLint surfAttrs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+    o->surf = eglCreatePbufferSurface(o->dpy, cfg, surfAttrs);
+    const EGLint ctxAttrs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE,
+    };
+    o->ctx = eglCreateContext(o->dpy, cfg, EGL_NO_CONTEXT, ctxAttrs);
+    if (o->surf == EGL_NO_SURFACE || o->ctx == EGL_NO_CONTEXT || !eglMakeCurrent(o->dpy, o->surf, o->surf, o->ctx))
+        return false;
+    glewExperimental = true;
+    GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // a GLX build of GLEW finds no GLX display, the GL functions are loaded
+    if (err == GLEW_ERROR_NO_GLX_DISPLAY)
+        err = GLEW_OK;
+#endif
+    fprintf(stderr, "offscreen: EGL %d.%d %s display, %s\n", major, minor, platform,
+            err == GLEW_OK ? (const char *)glGetString(GL_RENDERER) : "no GL");
+    return err == GLEW_OK;
+}
+
+static void offscreenFree(offscreen_t *o) {
+    if (o->dpy == EGL_NO_DISPLAY)
+        return;
+    eglMakeCurrent(o->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (o->ctx != EGL_NO_CONTEXT)
+        eglDestroyContext(o->dpy, o->ctx);
+    if (o->surf != EGL_NO_SURFACE)
+        eglDestroySurface(o->dpy, o->surf);
+    eglTerminate(o->dpy);
+}
+
+// a random empty point of the player hull and a random yaw, for each view
+static void randomViews(ZigLoadBSP *bsp, uint64_t seed, vec3 *eyes, vec3 *dirs) {
+    ZigBSPModel *world = bsp->models;
+    for (int v = 0; v < VIEWS; v++) {
+        glm_vec3_zero(eyes[v]);
+        for (int tries = 0; tries < 1000; tries++) {
+            vec3 pos;
+            for (int k = 0; k < 3; k++)
+                pos[k] = world->mins[k] + randf(&seed) * (world->maxs[k] - world->mins[k]);
+            if (PM_HullPointContents(bsp, bsp->hroot[0], pos) == CONTENTS_EMPTY) {
+                glm_vec3_copy(pos, eyes[v]);
+                break;
+            }
+        }
+        float yaw = randf(&seed) * 2.0f * GLM_PIf;
+        glm_vec3_copy((vec3){cosf(yaw), sinf(yaw), 0.0f}, dirs[v]);
+    }
+}
+
+// upload bsp, which m then owns, and draw frames from every view in turn
+static void renderMap(renderer_t *r, ZigLoadBSP *bsp, const options_t *opt, profsummary_t *ps, double *uploadMs, size_t *texBytes) {
+    map_t m;
+    memset(&m, 0, sizeof(m));
+    m.bsp = *bsp;
+    stream_t st;
+    streamInit(&st, 64 << 20);
+    double t0 = now();
+    mapCreate(&m, &st, r->mdiCaps);
+    while (!streamStep(&st))
+        ;
+    glFinish();
+    *uploadMs = (now() - t0) * 1e3;
+    *texBytes = m.texBytes;
+
+    vec3 eyes[VIEWS], dirs[VIEWS];
+    randomViews(&m.bsp, opt->seed, eyes, dirs);
+    mat4 proj, view, mvp;
+    glm_perspective(glm_rad(60.0f), (float)opt->width / opt->height, 8.0f, 16384.0f, proj);
+    glViewport(0, 0, opt->width, opt->height);
+    prof_t prof;
+    profInit(&prof, opt->frames);
+    for (int f = 0; f < opt->frames; f++) {
+        profFrame(&prof);
+        int v = f % VIEWS;
+        vec3 lookat;
+        glm_vec3_add(eyes[v], dirs[v], lookat);
+        glm_lookat(eyes[v], lookat, GLM_ZUP, view);
+        glm_mat4_mul(proj, view, mvp);
+        profGpuBegin(&prof);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        mapDraw(r, &m, mvp, eyes[v], &prof);
+        profGpuEnd(&prof);
+        // no swap to wait on, every frame is finished before the next
+        glFinish();
+    }
+    profFrame(&prof);
+    profSummary(&prof, ps);
+    profFree(&prof);
+    streamFree(&st);
+    mapFree(&m);
+}
+
+static bool benchMap(const char *path, const options_t *opt, renderer_t *r) {
+    bool peakReset = resetPeak();
+    long rssBefore = procStatus("VmRSS:");
+    double t0 = now();
+    ZigLoadBSP bsp;
+    if (zigLoadBSP(path, &bsp) != 0) {
+        fprintf(stderr, "can not load %s\n", path);
+        return false;
+    }
+    double loadMs = (now() - t0) * 1e3;
+    size_t cpuTexBytes = sizeof(*bsp.palettes) * bsp.pal_cnt;
+    for (size_t i = 0; i < bsp.text_cnt; i++) {
+        ZigBSPTex *t = bsp.textures + i;
+        size_t texels = 0;
+        for (int l = 0; l < 4; l++)
+            texels += (size_t)(t->width >> l) * (t->height >> l);
+        cpuTexBytes += t->indexs ? texels : t->pixels ? texels * 4 : 0;
+    }
+    cpuTexBytes += sizeof(*bsp.lightmap) * bsp.lm_size;
+    long peak = procStatus("VmHWM:"), rssAfter = procStatus("VmRSS:");
+
+    printf("{\"map\":");
+    jsonString(path);
+    printf(",\"load_ms\":%.3f,\"peak_rss_kb\":%ld,\"peak_reset\":%s,\"rss_kb\":%ld",
+           loadMs, peak, peakReset ? "true" : "false", rssAfter - rssBefore);
+    printf(",\"textures\":\"%s\",\"tex_bytes\":%zu", bsp.tex_fmt == TEX_INDEX ? "index" : "rgba", cpuTexBytes);
+    printf(",\"lightmap_width\":%u,\"lightmap_height\":%u", bsp.lm_width, bsp.lm_height);
+    printf(",\"queries\":%zu,\"seed\":%llu,\"hulls\":[", opt->queries, (unsigned long long)opt->seed);
+    for (int32_t hull = 0; hull < 3; hull++) {
+        hullrate_t hr;
+        benchHullRate(&bsp, hull, opt->queries, opt->seed + hull, &hr);
+        printf("%s{\"points_per_s\":%.0f,\"traces_per_s\":%.0f,\"checksum\":\"%016llx\"}",
+               hull ? "," : "", hr.points, hr.traces, (unsigned long long)hr.checksum);
+    }
+    printf("]");
+    if (r) {
+        profsummary_t ps;
+        double uploadMs;
+        size_t gpuTexBytes;
+        renderMap(r, &bsp, opt, &ps, &uploadMs, &gpuTexBytes);
+        printf(",\"render\":{\"width\":%d,\"height\":%d,\"prepass\":%s,\"upload_ms\":%.3f,\"gpu_tex_bytes\":%zu,\"frames\":%u,"
+               "\"avg_ms\":%.3f,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f,\"gpu_ms\":%.3f}",
+               opt->width, opt->height, opt->prepass ? "true" : "false", uploadMs, gpuTexBytes, ps.frames, ps.avg, ps.p50, ps.p90, ps.p99, ps.max, ps.gpuAvg);
+    } else {
+        printf(",\"render\":null");
+        zigFreeBSP(&bsp);
+    }
+    printf("}\n");
+    fflush(stdout);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    options_t opt = {.queries = 1000000, .seed = 1, .frames = 500, .width = 1280, .height = 720, .render = true};
+    int first = argc;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc)
+            opt.queries = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            opt.seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            opt.frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc) {
+            opt.width = atoi(argv[++i]);
+            opt.height = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--no-render") == 0)
+            opt.render = false;
+        else if (strcmp(argv[i], "--prepass") == 0)
+            opt.prepass = true;
+        else if (strcmp(argv[i], "--load-threads") == 0 && i + 1 < argc) {
+            if (!parseLoadThreads(argv[++i]))
+                return 2;
+        } else if (strcmp(argv[i], "--paletted") == 0)
+            zigLoadOptions.paletted = 1;
+        else {
+            first = i;
+            break;
+        }
+    }
+    if (first == argc || opt.frames <= 0 || opt.width <= 0 || opt.height <= 0) {
+        fprintf(stderr, "usage: %s [--queries N] [--seed S] [--frames F] [--size W H] [--no-render] [--prepass] [--load-threads K] [--paletted] map.bsp...\n", argv[0]);
+        return 2;
+    }
+
+    offscreen_t off;
+    renderer_t rnd;
+    renderer_t *r = NULL;
+    if (opt.render) {
+        if (offscreenInit(&off, opt.width, opt.height) && rendererInit(&rnd)) {
+            rnd.prepass = opt.prepass;
+            r = &rnd;
+        }
+        else
+            fprintf(stderr, "no offscreen context, frame times are left out\n");
+    }
+    int failed = 0;
+    for (int i = first; i < argc; i++)
+        failed += !benchMap(argv[i], &opt, r);
+    if (r)
+        rendererFree(r);
+    if (opt.render)
+        offscreenFree(&off);
+    return failed ? 1 : 0;
+}
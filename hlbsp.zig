@@ -48,8 +48,81 @@ pub const Lump = extern struct {
     length: u32,
 };
 
-/// lump 0 entities: []u8
-pub const EntityLump = @compileError("ascii text");
+/// lump 0 entities: ascii text, { "key" "value" ... } per entity
+/// tokens are slices of the lump, nothing is copied
+pub const EntityLump = struct {
+    const Self = @This();
+    text: []const u8,
+    pos: usize = 0,
+    pub fn init(text: []const u8) Self {
+        // the lump usually ends with a nul
+        const end = std.mem.indexOfScalar(u8, text, 0) orelse text.len;
+        return .{ .text = text[0..end] };
+    }
+    /// next entity, null at the end or on malformed text
+    pub fn next(self: *Self) ?Entity {
+        if (self.token() != .open) return null;
+        const begin = self.pos;
+        while (true) switch (self.token()) {
+            .string => {},
+            .close => return .{ .text = self.text[begin .. self.pos - 1] },
+            else => return null,
+        };
+    }
+    const Token = union(enum) {
+        open,
+        close,
+        /// without the quotes
+        string: []const u8,
+        bad,
+    };
+    fn token(self: *Self) Token {
+        const s = self.text;
+        while (self.pos < s.len and std.ascii.isWhitespace(s[self.pos])) self.pos += 1;
+        if (self.pos >= s.len) return .bad;
+        const c = s[self.pos];
+        self.pos += 1;
+        switch (c) {
+            '{' => return .open,
+            '}' => return .close,
+            '"' => {
+                const end = std.mem.indexOfScalarPos(u8, s, self.pos, '"') orelse return .bad;
+                defer self.pos = end + 1;
+                return .{ .string = s[self.pos..end] };
+            },
+            else => return .bad,
+        }
+    }
+};
+
+pub const Entity = struct {
+    const Self = @This();
+    /// between the braces
+    text: []const u8,
+    pub const Pair = struct {
+        key: []const u8,
+        value: []const u8,
+    };
+    pub const Iterator = struct {
+        lump: EntityLump,
+        pub fn next(self: *Iterator) ?Pair {
+            const key = self.lump.token();
+            const value = self.lump.token();
+            if (key != .string or value != .string) return null;
+            return .{ .key = key.string, .value = value.string };
+        }
+    };
+    pub fn iterator(self: Self) Iterator {
+        return .{ .lump = .{ .text = self.text } };
+    }
+    /// value of the first pair with key
+    pub fn get(self: Self, key: []const u8) ?[]const u8 {
+        var it = self.iterator();
+        while (it.next()) |p|
+            if (std.mem.eql(u8, p.key, key)) return p.value;
+        return null;
+    }
+};
 
 pub const vec3 = [3]f32;
 
@@ -137,6 +210,18 @@ pub const TexInfo = extern struct {
     fTShift: f32,
     iMipTex: u32,
     flags: u32,
+    /// flags: sky or liquid, drawn without lightmap
+    pub const special = 1;
+    /// position in texels, not divided by the texture size, in f64 so the
+    /// lightmap extents round the same way for every vertex of a face
+    pub fn calcTexel(self: Self, vtx: vec3) [2]f64 {
+        var st = [2]f64{ self.fSShift, self.fTShift };
+        for (0..3) |k| {
+            st[0] += @as(f64, vtx[k]) * self.vS[k];
+            st[1] += @as(f64, vtx[k]) * self.vT[k];
+        }
+        return st;
+    }
     pub fn calcST(self: Self, vtx: vec3, w: u32, h: u32) [2]f32 {
         return .{
             (vtx[0] * self.vS[0] + vtx[1] * self.vS[1] + vtx[2] * self.vS[2] + self.fSShift) / @as(f32, @floatFromInt(w)),
@@ -156,7 +241,8 @@ pub const Face = extern struct {
     lightmapOffset: u32,
 };
 
-/// lump 8 lighting
+/// lump 8 lighting, Face.lightmapOffset is a byte offset into it, one
+/// lightmap per style in Face.styles that is not 255
 pub const LightmapLump = @compileError("array of rgb ([3]u8)");
 
 /// lump 9 clipnodes: []ClipNode
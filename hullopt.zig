@@ -0,0 +1,128 @@
+//! Clipnodes for the traces: every node carries its plane, tagged when it
+//! is axial, and the nodes of the world hulls are put in van Emde Boas
+//! order, so a walk down a deep hull touches few cache lines.
+const std = @import("std");
+const bsp = @import("hlbsp.zig");
+const alloc = std.heap.c_allocator;
+
+/// type of a plane that is not along an axis
+pub const axis_any = 3;
+
+/// a clipnode with its plane, 2 per cache line
+pub const HullNode = extern struct {
+    normal: [3]f32,
+    dist: f32,
+    /// hull node index, or contents if negative
+    children: [2]i32,
+    /// 0, 1, 2: normal is the x, y or z axis, else axis_any
+    type: u32,
+    _pad: u32 = 0,
+};
+
+pub const Hulls = struct {
+    nodes: []align(64) HullNode,
+    roots: [3]i32,
+};
+
+fn planeType(p: bsp.Plane) u32 {
+    for (0..3) |k| {
+        if (p.normal[k] == 1.0 and p.normal[(k + 1) % 3] == 0.0 and p.normal[(k + 2) % 3] == 0.0)
+            return @intCast(k);
+    }
+    return axis_any;
+}
+
+/// hull nodes of the clipnodes; with veb only the nodes of the world hulls
+/// are kept, in van Emde Boas order, else all of them in file order
+pub fn build(clips: []const bsp.ClipNode, planes: []const bsp.Plane, roots: [3]i32, veb: bool) !Hulls {
+    var layout = try Layout.init(clips);
+    defer layout.deinit();
+    if (veb) {
+        for (roots) |r| if (r >= 0) try layout.run(r, layout.height(r));
+    } else {
+        for (0..clips.len) |i| try layout.emit(@intCast(i));
+    }
+
+    const nodes = try alloc.alignedAlloc(HullNode, 64, layout.order.items.len);
+    for (nodes, layout.order.items) |*n, old| {
+        const c = clips[old];
+        const p = planes[c.iPlane];
+        n.* = .{
+            .normal = p.normal,
+            .dist = p.dist,
+            .children = .{ layout.map(c.iChildren[0]), layout.map(c.iChildren[1]) },
+            .type = planeType(p),
+        };
+    }
+    var axial: usize = 0;
+    for (nodes) |n| axial += @intFromBool(n.type != axis_any);
+    for (roots, 0..) |r, h| if (r >= 0) {
+        _ = std.c.printf("hull %zu: depth %u\n", h + 1, layout.height(r));
+    };
+    _ = std.c.printf("hull nodes: %zu, axial: %zu, %s order\n", nodes.len, axial, @as([*:0]const u8, if (veb) "van Emde Boas" else "file"));
+    return .{ .nodes = nodes, .roots = .{ layout.map(roots[0]), layout.map(roots[1]), layout.map(roots[2]) } };
+}
+
+const unset = -1;
+
+const Layout = struct {
+    clips: []const bsp.ClipNode,
+    heights: []u32, // 0 until known
+    remap: []i32, // new index of every clipnode, or unset
+    order: std.ArrayList(u32), // clipnodes in the new order
+
+    fn init(clips: []const bsp.ClipNode) !Layout {
+        const heights = try alloc.alloc(u32, clips.len);
+        errdefer alloc.free(heights);
+        @memset(heights, 0);
+        const remap = try alloc.alloc(i32, clips.len);
+        @memset(remap, unset);
+        return .{ .clips = clips, .heights = heights, .remap = remap, .order = std.ArrayList(u32).init(alloc) };
+    }
+
+    fn deinit(self: *Layout) void {
+        alloc.free(self.heights);
+        alloc.free(self.remap);
+        self.order.deinit();
+    }
+
+    /// levels of nodes below and including num
+    fn height(self: *Layout, num: i32) u32 {
+        if (num < 0) return 0;
+        const i: usize = @intCast(num);
+        if (self.heights[i] == 0) {
+            const c = self.clips[i];
+            self.heights[i] = 1 + @max(self.height(c.iChildren[0]), self.height(c.iChildren[1]));
+        }
+        return self.heights[i];
+    }
+
+    fn map(self: *const Layout, num: i32) i32 {
+        return if (num < 0) num else self.remap[@intCast(num)];
+    }
+
+    /// a node reached twice, if hulls share them, keeps its first place
+    fn emit(self: *Layout, num: u32) !void {
+        if (self.remap[num] != unset) return;
+        self.remap[num] = @intCast(self.order.items.len);
+        try self.order.append(num);
+    }
+
+    /// the first levels of the tree at num: the top half of them, then
+    /// every tree hanging below it, each laid out the same way
+    fn run(self: *Layout, num: i32, levels: u32) !void {
+        if (num < 0 or levels == 0) return;
+        if (levels == 1) return self.emit(@intCast(num));
+        const top = levels / 2;
+        try self.run(num, top);
+        try self.below(num, top, levels - top);
+    }
+
+    fn below(self: *Layout, num: i32, depth: u32, levels: u32) !void {
+        if (num < 0) return;
+        if (depth == 0) return self.run(num, levels);
+        const c = self.clips[@intCast(num)];
+        try self.below(c.iChildren[0], depth - 1, levels);
+        try self.below(c.iChildren[1], depth - 1, levels);
+    }
+};
@@ -0,0 +1,268 @@
+//! Lightmap atlas: the lightmap of every face goes from the lighting lump
+//! into one rgb texture. Faces are sorted by height and dealt round robin
+//! to strips of the atlas, every strip is packed into shelves by its own
+//! job, so the packing runs in parallel and gives the same atlas for any
+//! number of threads.
+const std = @import("std");
+const bsp = @import("hlbsp.zig");
+const par = @import("parallel.zig");
+const alloc = std.heap.c_allocator;
+
+/// texels of the texinfo per luxel
+pub const luxel_size = 16;
+
+/// narrowest strip, a strip is as wide as the widest lightmap at least
+const min_strip = 128;
+
+/// the engine rejects lit faces whose extents pass 256 texels, 16 luxel
+/// steps or 17 luxels; larger lightmaps are broken, those faces are drawn
+/// unlit
+const max_steps = 256 / luxel_size;
+
+/// widest and tallest atlas: the quantized lightmap coordinates keep 1/16
+/// luxel up to here and GL drivers take a 2D texture this large; a map
+/// whose atlas is larger is drawn unlit
+pub const max_side = 4096;
+
+/// white square for the faces without lightmap, they use its middle
+/// luxel, which filters to white
+const white_size = 3;
+
+/// faces per job of the extents stage
+const face_chunk = 1024;
+
+/// where the lightmap of a face is in the atlas
+pub const FaceLight = struct {
+    /// first luxel in texinfo texels over luxel_size, floor of the face
+    mins: [2]i32 = .{ 0, 0 },
+    /// luxels, 0 if the face has no lightmap
+    w: u32 = 0,
+    h: u32 = 0,
+    x: u32 = 0,
+    y: u32 = 0,
+};
+
+pub const Atlas = struct {
+    faces: []FaceLight,
+    /// width * height luxels, owned by the caller after build
+    pixels: [][3]u8,
+    width: u32,
+    height: u32,
+    /// corner of the white square
+    white: [2]u32,
+
+    pub fn deinit(self: *Atlas) void {
+        alloc.free(self.faces);
+    }
+
+    /// atlas coordinates of a vertex of face f, at luxel centers
+    pub fn uv(self: *const Atlas, f: usize, texinfo: bsp.TexInfo, pos: bsp.vec3) [2]f32 {
+        const fl = self.faces[f];
+        var luxel = [2]f64{
+            @as(f64, @floatFromInt(self.white[0])) + white_size / 2.0,
+            @as(f64, @floatFromInt(self.white[1])) + white_size / 2.0,
+        };
+        if (fl.w != 0) {
+            const st = texinfo.calcTexel(pos);
+            luxel = .{
+                @as(f64, @floatFromInt(fl.x)) + st[0] / luxel_size - @as(f64, @floatFromInt(fl.mins[0])) + 0.5,
+                @as(f64, @floatFromInt(fl.y)) + st[1] / luxel_size - @as(f64, @floatFromInt(fl.mins[1])) + 0.5,
+            };
+        }
+        return .{
+            @floatCast(luxel[0] / @as(f64, @floatFromInt(self.width))),
+            @floatCast(luxel[1] / @as(f64, @floatFromInt(self.height))),
+        };
+    }
+};
+
+/// inputs of the atlas, loaded[f] is false for faces that are not drawn
+pub const Input = struct {
+    faces: []align(1) const bsp.Face,
+    texinfos: []align(1) const bsp.TexInfo,
+    surfedges: []align(1) const bsp.SurfEdge,
+    edges: []align(1) const bsp.Edge,
+    vertices: []align(1) const bsp.VertexLump,
+    lighting: []const u8,
+    loaded: []const bool,
+};
+
+/// lightmap extents of every loaded face, pack them and copy their first
+/// style into the atlas; prints the time of every stage and the share of
+/// the atlas that lightmaps cover
+pub fn build(threads: usize, in: Input) !Atlas {
+    var timer = try std.time.Timer.start();
+    const faces = try alloc.alloc(FaceLight, in.faces.len);
+    errdefer alloc.free(faces);
+    @memset(faces, .{});
+    const extents = Extents{ .in = in, .out = faces };
+    par.forEach(threads, (faces.len + face_chunk - 1) / face_chunk, &extents, Extents.run);
+    const extents_ms = msSince(&timer);
+
+    // lit faces and the white square, which is the index faces.len
+    var order = std.ArrayList(u32).init(alloc);
+    defer order.deinit();
+    var area: usize = white_size * white_size;
+    var widest: u32 = white_size;
+    for (faces, 0..) |fl, f| {
+        if (fl.w == 0) continue;
+        try order.append(@intCast(f));
+        area += fl.w * fl.h;
+        widest = @max(widest, fl.w);
+    }
+    try order.append(@intCast(faces.len));
+    var white = FaceLight{ .w = white_size, .h = white_size };
+    const Sizes = struct {
+        faces: []const FaceLight,
+        white: *const FaceLight,
+        fn get(self: @This(), i: u32) FaceLight {
+            return if (i < self.faces.len) self.faces[i] else self.white.*;
+        }
+        /// tallest first, then widest, then by index, a total order
+        fn lessThan(self: @This(), a: u32, b: u32) bool {
+            const fa = self.get(a);
+            const fb = self.get(b);
+            if (fa.h != fb.h) return fa.h > fb.h;
+            if (fa.w != fb.w) return fa.w > fb.w;
+            return a < b;
+        }
+    };
+    const sizes = Sizes{ .faces = faces, .white = &white };
+    std.mem.sort(u32, order.items, sizes, Sizes.lessThan);
+
+    // a square atlas of a bit more than the area, in whole strips
+    const strip = @max(min_strip, std.math.ceilPowerOfTwoAssert(u32, widest));
+    const side: u32 = @intFromFloat(@ceil(@sqrt(@as(f64, @floatFromInt(area)) * 1.1)));
+    const width = @max(strip, std.math.ceilPowerOfTwoAssert(u32, side));
+    const strips = try alloc.alloc(u32, width / strip);
+    defer alloc.free(strips);
+    const packer = Packer{ .order = order.items, .faces = faces, .white = &white, .strip = strip, .heights = strips };
+    par.forEach(threads, strips.len, &packer, Packer.run);
+    var height: u32 = 1;
+    for (strips) |h| height = @max(height, h);
+    const pack_ms = msSince(&timer);
+    if (width > max_side or height > max_side) {
+        _ = std.c.printf("lightmap atlas: %ux%u is over %u luxels, faces are drawn unlit\n", width, height, @as(u32, max_side));
+        @memset(faces, .{});
+        const pixels = try alloc.alloc([3]u8, white_size * white_size);
+        @memset(pixels, .{ 255, 255, 255 });
+        return .{ .faces = faces, .pixels = pixels, .width = white_size, .height = white_size, .white = .{ 0, 0 } };
+    }
+
+    const pixels = try alloc.alloc([3]u8, @as(usize, width) * height);
+    errdefer alloc.free(pixels);
+    @memset(pixels, .{ 0, 0, 0 });
+    for (0..white_size) |y|
+        @memset(pixels[(white.y + y) * width + white.x ..][0..white_size], .{ 255, 255, 255 });
+    const copier = Copier{ .in = in, .faces = faces, .pixels = pixels, .width = width };
+    par.forEach(threads, (faces.len + face_chunk - 1) / face_chunk, &copier, Copier.run);
+    const copy_ms = msSince(&timer);
+
+    _ = std.c.printf("lightmap atlas: %ux%u, %zu faces, %.1f%% occupied, extents %.3f ms, pack %.3f ms (%zu strips), copy %.3f ms\n",
+        width, height, order.items.len - 1, 100 * @as(f64, @floatFromInt(area)) / @as(f64, @floatFromInt(pixels.len)),
+        extents_ms, pack_ms, strips.len, copy_ms);
+    return .{ .faces = faces, .pixels = pixels, .width = width, .height = height, .white = .{ white.x, white.y } };
+}
+
+fn msSince(timer: *std.time.Timer) f64 {
+    return @as(f64, @floatFromInt(timer.lap())) / std.time.ns_per_ms;
+}
+
+/// luxel bounds of every face, as the engine computes them
+const Extents = struct {
+    in: Input,
+    out: []FaceLight,
+
+    fn run(self: *const Extents, worker: usize, job: usize) void {
+        _ = worker;
+        const f0 = job * face_chunk;
+        for (f0..@min(f0 + face_chunk, self.out.len)) |f|
+            self.out[f] = self.face(f);
+    }
+
+    fn face(self: *const Extents, f: usize) FaceLight {
+        const in = self.in;
+        const fc = in.faces[f];
+        const texinfo = in.texinfos[fc.iTexInfo];
+        if (!in.loaded[f] or fc.styles[0] == 255 or fc.lightmapOffset == std.math.maxInt(u32) or
+            texinfo.flags & bsp.TexInfo.special != 0) return .{};
+        var lo = [2]f64{ std.math.inf(f64), std.math.inf(f64) };
+        var hi = [2]f64{ -std.math.inf(f64), -std.math.inf(f64) };
+        for (in.surfedges[fc.iEdge0..][0..fc.nEdges]) |surfedge| {
+            const abs = std.math.absCast(surfedge);
+            const st = texinfo.calcTexel(in.vertices[in.edges[abs][@intFromBool(surfedge < 0)]]);
+            for (0..2) |c| {
+                lo[c] = @min(lo[c], st[c]);
+                hi[c] = @max(hi[c], st[c]);
+            }
+        }
+        var fl = FaceLight{};
+        var size: [2]u32 = undefined;
+        for (0..2) |c| {
+            const mins = @floor(lo[c] / luxel_size);
+            const maxs = @ceil(hi[c] / luxel_size);
+            if (!(maxs - mins <= max_steps and @fabs(mins) < 1 << 24)) return .{};
+            fl.mins[c] = @intFromFloat(mins);
+            size[c] = @intFromFloat(maxs - mins + 1);
+        }
+        if (fc.lightmapOffset > in.lighting.len or size[0] * size[1] * 3 > in.lighting.len - fc.lightmapOffset)
+            return .{};
+        fl.w = size[0];
+        fl.h = size[1];
+        return fl;
+    }
+};
+
+/// strip s takes every strips-th face of the order, from s on, and fills
+/// shelves left to right; the first face of a shelf is its tallest
+const Packer = struct {
+    order: []const u32,
+    faces: []FaceLight,
+    white: *FaceLight,
+    strip: u32,
+    heights: []u32,
+
+    fn run(self: *const Packer, worker: usize, s: usize) void {
+        _ = worker;
+        const x0: u32 = @intCast(s * self.strip);
+        var x: u32 = 0;
+        var y: u32 = 0;
+        var shelf: u32 = 0;
+        var i = s;
+        while (i < self.order.len) : (i += self.heights.len) {
+            const f = self.order[i];
+            const fl = if (f < self.faces.len) &self.faces[f] else self.white;
+            if (x + fl.w > self.strip) {
+                y += shelf;
+                x = 0;
+                shelf = 0;
+            }
+            if (shelf == 0) shelf = fl.h;
+            fl.x = x0 + x;
+            fl.y = y;
+            x += fl.w;
+        }
+        self.heights[s] = y + shelf;
+    }
+};
+
+/// the first style of every lightmap to its place, rows of the lump are
+/// rows of the atlas
+const Copier = struct {
+    in: Input,
+    faces: []const FaceLight,
+    pixels: [][3]u8,
+    width: u32,
+
+    fn run(self: *const Copier, worker: usize, job: usize) void {
+        _ = worker;
+        const f0 = job * face_chunk;
+        for (f0..@min(f0 + face_chunk, self.faces.len)) |f| {
+            const fl = self.faces[f];
+            if (fl.w == 0) continue;
+            const src: []align(1) const [3]u8 = std.mem.bytesAsSlice([3]u8, self.in.lighting[self.in.faces[f].lightmapOffset..][0 .. fl.w * fl.h * 3]);
+            for (0..fl.h) |row|
+                @memcpy(self.pixels[(fl.y + row) * self.width + fl.x ..][0..fl.w], src[row * fl.w ..][0..fl.w]);
+        }
+    }
+};
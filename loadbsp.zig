@@ -1,8 +1,13 @@
 const std = @import("std");
 const bsp = @import("hlbsp.zig");
+const mapcache = @import("mapcache.zig");
+const meshopt = @import("meshopt.zig");
+const hullopt = @import("hullopt.zig");
+const lightmap = @import("lightmap.zig");
+const par = @import("parallel.zig");
 const alloc = std.heap.c_allocator;
 
-const ZigLoadBSP = extern struct {
+pub const ZigLoadBSP = extern struct {
     vbo_data: [*]u8,
     vbo_size: usize,
     ebo_data: [*]u8,
@@ -16,22 +21,178 @@ const ZigLoadBSP = extern struct {
     world_h3: i32,
     b_planes: [*]bsp.Plane,
     planecnt: usize,
+    world_h0: i32,
+    nodes: [*]bsp.Node,
+    nodecnt: usize,
+    leaves: [*]bsp.Leaf,
+    leafcnt: usize,
+    visleafs: usize,
+    marksurf: [*]u16,
+    markcnt: usize,
+    visdata: [*]u8,
+    vis_size: usize,
+    facedraw: [*]ZigBSPFace,
+    face_cnt: usize,
+    world_nf: usize,
+    /// if not null, the lump arrays above point into this mapping of the file
+    mapping: ?[*]align(std.mem.page_size) const u8,
+    map_size: usize,
+    texarrs: [*]ZigBSPTexArr,
+    tarr_cnt: usize,
+    /// everything above is in the mapping, which is a map cache file
+    cached: u8,
+    /// vtx_float: vbo is ZigBSPVertex, vtx_quant: vbo is ZigBSPVertexQ
+    vtx_fmt: u8,
+    /// bytes per index, 2 or 4, indices are relative to ZigBSPTex.iVertex0
+    idx_size: u8,
+    /// tex_rgba: textures have pixels, tex_index: indexs and palettes
+    tex_fmt: u8,
+    /// world units per step of ZigBSPVertexQ.pos, 1 for vtx_float
+    pos_scale: f32,
+    models: [*]ZigBSPModel,
+    model_cnt: usize,
+    /// index ranges of the models, one per texture, like faces
+    ranges: [*]ZigBSPFace,
+    range_cnt: usize,
+    /// clipnodes with their planes, for the traces
+    hullnode: [*]align(64) hullopt.HullNode,
+    hnode_cnt: usize,
+    /// roots of world_h1, world_h2 and world_h3 in hullnode
+    hroot: [3]i32,
+    /// keyed rgba palette of every texture for tex_index, else none
+    palettes: [*][256][4]u8,
+    pal_cnt: usize,
+    /// lightmap atlas, lm_width * lm_height rgb luxels, see lightmap.zig
+    lightmap: [*][3]u8,
+    lm_size: usize,
+    lm_width: u32,
+    lm_height: u32,
+    /// hull grids, set from C after loading (see PM_GridAttach), null here
+    grids: ?*anyopaque,
 };
 
-const ZigBSPTex = extern struct {
+/// load options, set from C before loading
+pub const ZigLoadOptions = extern struct {
+    /// weld and quantize vertices, see compactMesh
+    compact: u8 = 1,
+    /// order faces for the vertex cache, with compact only; off by default
+    /// as faces share no vertices since the lightmap atlas
+    reorder: u8 = 0,
+    /// world hull nodes in van Emde Boas order, else all in file order
+    relayout: u8 = 1,
+    /// loader threads, 0 is one per core; the result is the same for any
+    threads: u8 = 0,
+    /// keep textures as indices and palettes, a quarter of the rgba size
+    paletted: u8 = 0,
+};
+
+pub export var zigLoadOptions: ZigLoadOptions = .{};
+
+pub const vtx_float = 0;
+pub const vtx_quant = 1;
+
+pub const tex_rgba = 0;
+pub const tex_index = 1;
+
+pub const ZigBSPVertex = extern struct {
+    pos: [3]f32,
+    tex: [2]f32,
+    /// in the lightmap atlas, 0 to 1
+    lm: [2]f32,
+};
+
+/// position in steps of pos_scale, texture coordinates as half floats,
+/// lightmap coordinates normalized, 0 to 65535
+pub const ZigBSPVertexQ = extern struct {
+    pos: [3]i16,
+    _pad: i16 = 0,
+    tex: [2]u16,
+    lm: [2]u16,
+};
+
+pub const ZigBSPTex = extern struct {
     width: u32,
     height: u32,
     i3Index0: u32,
     n3Indexs: u32,
+    /// all 4 mip levels, each (width >> l) * (height >> l), back to back
     pixels: ?[*][4]u8,
     skipped: u8,
+    /// 1 if some texel is keyed out, drawn alpha-tested, 0 if opaque
+    alpha: u8,
+    /// index into ZigLoadBSP.texarrs, and layer in that array
+    texarr: u16,
+    layer: u16,
+    /// base vertex of the indices
+    iVertex0: u32,
+    /// for tex_index instead of pixels: palette indices, laid out like pixels
+    indexs: ?[*]u8,
+};
+
+/// textures of the same size share one texture array
+pub const ZigBSPTexArr = extern struct {
+    width: u32,
+    height: u32,
+    layers: u32,
+};
+
+/// minimum GL_MAX_ARRAY_TEXTURE_LAYERS
+const max_layers = 256;
+
+/// index range of one face inside its texture group, zero if not loaded
+pub const ZigBSPFace = extern struct {
+    i3Index0: u32,
+    n3Indexs: u32,
+    iTexture: u32,
+};
+
+/// brush model 0 is the world, the others belong to entities
+pub const ZigBSPModel = extern struct {
+    mins: [3]i16,
+    maxs: [3]i16,
+    iFace0: u32,
+    nFaces: u32,
+    /// into ZigLoadBSP.ranges, the faces of the model are contiguous in
+    /// every texture group
+    iRange0: u32,
+    nRanges: u32,
+    /// trigger or invisible entity, its faces are not loaded
+    dropped: u8,
 };
 
 export fn zigLoadBSP(
     i_filename: [*:0]const u8,
     o_ldresult: *ZigLoadBSP,
 ) i32 {
-    if (loadBSP(i_filename)) |result| {
+    if (loadBSP(i_filename, false)) |result| {
+        o_ldresult.* = result;
+        return 0;
+    } else |_| {
+        return -1;
+    }
+}
+
+/// same as zigLoadBSP, but clipnodes, planes, nodes, leaves, marksurfaces
+/// and visibility stay in a read-only mapping of the file until zigFreeBSP
+export fn zigMapBSP(
+    i_filename: [*:0]const u8,
+    o_ldresult: *ZigLoadBSP,
+) i32 {
+    if (loadBSP(i_filename, true)) |result| {
+        o_ldresult.* = result;
+        return 0;
+    } else |_| {
+        return -1;
+    }
+}
+
+/// same as zigMapBSP, but use the map cache next to the file (name.bsp.cache)
+/// if it matches the hash of the file, else load and write the cache
+export fn zigLoadBSPCached(
+    i_filename: [*:0]const u8,
+    o_ldresult: *ZigLoadBSP,
+) i32 {
+    if (loadBSPCached(i_filename)) |result| {
         o_ldresult.* = result;
         return 0;
     } else |_| {
@@ -42,23 +203,110 @@ export fn zigLoadBSP(
 export fn zigFreeBSP(
     i_ldresult: *ZigLoadBSP,
 ) void {
+    if (i_ldresult.cached != 0) {
+        std.os.munmap(i_ldresult.mapping.?[0..i_ldresult.map_size]);
+        return;
+    }
     alloc.free(i_ldresult.vbo_data[0..i_ldresult.vbo_size]);
     alloc.free(i_ldresult.ebo_data[0..i_ldresult.ebo_size]);
     const textures = i_ldresult.textures[0..i_ldresult.text_cnt];
-    for (textures) |t| if (t.pixels) |p| alloc.free(p[0 .. t.width * t.height]);
+    for (textures) |t| {
+        if (t.pixels) |p| alloc.free(p[0..mipPixelCount(t.width, t.height)]);
+        if (t.indexs) |p| alloc.free(p[0..mipPixelCount(t.width, t.height)]);
+    }
     alloc.free(textures);
+    alloc.free(i_ldresult.palettes[0..i_ldresult.pal_cnt]);
+    alloc.free(i_ldresult.lightmap[0..i_ldresult.lm_size]);
+    alloc.free(i_ldresult.texarrs[0..i_ldresult.tarr_cnt]);
+    alloc.free(i_ldresult.facedraw[0..i_ldresult.face_cnt]);
+    alloc.free(i_ldresult.models[0..i_ldresult.model_cnt]);
+    alloc.free(i_ldresult.ranges[0..i_ldresult.range_cnt]);
+    alloc.free(i_ldresult.hullnode[0..i_ldresult.hnode_cnt]);
+    if (i_ldresult.mapping) |m| {
+        std.os.munmap(m[0..i_ldresult.map_size]);
+        return;
+    }
     alloc.free(i_ldresult.clipnode[0..i_ldresult.clip_cnt]);
     alloc.free(i_ldresult.b_planes[0..i_ldresult.planecnt]);
+    alloc.free(i_ldresult.nodes[0..i_ldresult.nodecnt]);
+    alloc.free(i_ldresult.leaves[0..i_ldresult.leafcnt]);
+    alloc.free(i_ldresult.marksurf[0..i_ldresult.markcnt]);
+    alloc.free(i_ldresult.visdata[0..i_ldresult.vis_size]);
+}
+
+fn loadBSPCached(i_filename: [*:0]const u8) anyerror!ZigLoadBSP {
+    var timer = try std.time.Timer.start();
+    const file = try std.fs.cwd().openFileZ(i_filename, .{});
+    const key = mapcache.hashFile(file) catch |e| {
+        file.close();
+        return e;
+    };
+    file.close();
+    const hash_ms = msSince(&timer);
+
+    var pathbuf: [std.fs.MAX_PATH_BYTES]u8 = undefined;
+    const path = try std.fmt.bufPrintZ(&pathbuf, "{s}.cache", .{std.mem.span(i_filename)});
+    if (mapcache.load(path, key.hash, key.size)) |result| {
+        _ = std.c.printf("map cache hit: %.3f ms (hash %.3f ms)\n", msSince(&timer) + hash_ms, hash_ms);
+        return result;
+    } else |_| {}
+
+    const result = try loadBSP(i_filename, true);
+    const load_ms = msSince(&timer);
+    mapcache.store(path, key.hash, key.size, &result) catch |e|
+        std.debug.print("map cache not written: {}\n", .{e});
+    const write_ms = msSince(&timer);
+    _ = std.c.printf("map cache miss: %.3f ms (hash %.3f ms, write %.3f ms)\n", hash_ms + load_ms + write_ms, hash_ms, write_ms);
+    return result;
+}
+
+/// milliseconds since the last call, or since the timer started
+fn msSince(timer: *std.time.Timer) f64 {
+    return @as(f64, @floatFromInt(timer.lap())) / std.time.ns_per_ms;
+}
+
+/// use lump in place if it is in a mapped file, else copy it
+fn keepLump(comptime T: type, lump: []align(1) const T, inplace: bool) ![]T {
+    if (inplace) {
+        const aligned: []const T = @alignCast(lump);
+        return @constCast(aligned);
+    }
+    const copy = try alloc.alloc(T, lump.len);
+    @memcpy(copy, lump);
+    return copy;
 }
 
-fn loadBSP(i_filename: [*:0]const u8) anyerror!ZigLoadBSP {
-    // read file
+fn dropLump(lump: anytype, inplace: bool) void {
+    if (!inplace) alloc.free(lump);
+}
+
+fn isAligned(lump: anytype) bool {
+    const T = @typeInfo(@TypeOf(lump)).Pointer.child;
+    return std.mem.isAligned(@intFromPtr(lump.ptr), @alignOf(T));
+}
+
+fn loadBSP(i_filename: [*:0]const u8, i_mapfile: bool) anyerror!ZigLoadBSP {
+    const compact = zigLoadOptions.compact != 0;
+    const reorder = compact and zigLoadOptions.reorder != 0;
+    const paletted = zigLoadOptions.paletted != 0;
+
+    // read or map file
     const file = try std.fs.cwd().openFileZ(i_filename, .{});
     defer file.close();
     const fsize: usize = @intCast(try file.getEndPos());
-    const bytes = try alloc.alloc(u8, fsize);
-    defer alloc.free(bytes);
-    _ = try file.readAll(bytes);
+    const mapping: ?[]align(std.mem.page_size) const u8 = if (i_mapfile)
+        try std.os.mmap(null, fsize, std.os.PROT.READ, std.os.MAP.PRIVATE, file.handle, 0)
+    else
+        null;
+    var keepmap = false;
+    defer if (mapping) |m| if (!keepmap) std.os.munmap(m);
+    const bytes: []const u8 = if (mapping) |m| m else blk: {
+        const buf = try alloc.alloc(u8, fsize);
+        errdefer alloc.free(buf);
+        _ = try file.readAll(buf);
+        break :blk buf;
+    };
+    defer if (mapping == null) alloc.free(bytes);
 
     // get bsp lumps
     const bspfile = bsp.Header.fromBytes(bytes);
@@ -71,9 +319,20 @@ fn loadBSP(i_filename: [*:0]const u8) anyerror!ZigLoadBSP {
     const vertices = bspfile.getLumpArr(bspfile.vertices, bsp.VertexLump);
     const surfedges = bspfile.getLumpArr(bspfile.surfedges, bsp.SurfEdge);
     const clipnodes = bspfile.getLumpArr(bspfile.clipnodes, bsp.ClipNode);
+    const nodes = bspfile.getLumpArr(bspfile.nodes, bsp.Node);
+    const leaves = bspfile.getLumpArr(bspfile.leaves, bsp.Leaf);
+    const marksurfs = bspfile.getLumpArr(bspfile.marksurfaces, u16);
+    const visdata = bspfile.getLumpBytes(bspfile.visibility);
+    const lighting = bspfile.getLumpBytes(bspfile.lighting);
     const miptexoff = textures.getOffsets();
+    const entities = bspfile.getLumpBytes(bspfile.entities);
+
+    // misaligned lumps can not be used in place, copy everything then
+    const inplace = mapping != null and isAligned(clipnodes) and isAligned(planes) and
+        isAligned(nodes) and isAligned(leaves) and isAligned(marksurfs);
 
     const TexFaceGrp = struct {
+        iVertexB: u32,
         iVertex0: u32,
         iVertexX: u32,
         nVertexs: u32,
@@ -86,9 +345,15 @@ fn loadBSP(i_filename: [*:0]const u8) anyerror!ZigLoadBSP {
     defer alloc.free(texFaceGroup);
     @memset(std.mem.sliceAsBytes(texFaceGroup), 0);
 
+    // brush models, without triggers and invisible entities
+    const ldmodels = try alloc.alloc(ZigBSPModel, models.len);
+    errdefer alloc.free(ldmodels);
+    const ndropped = loadModels(ldmodels, models, entities);
+    _ = std.c.printf("models = %zu, dropped %u invisible\n", models.len, ndropped);
+
     // count vertices and indices
-    // const mdl = models[0];
-    for (models) |mdl| {
+    for (models, ldmodels) |mdl, ldmdl| {
+        if (ldmdl.dropped != 0) continue;
         for (faces[mdl.iFace0..][0..mdl.nFaces]) |face| {
             const texinfo = texinfos[face.iTexInfo];
             const iMipTex = texinfo.iMipTex;
@@ -109,101 +374,217 @@ fn loadBSP(i_filename: [*:0]const u8) anyerror!ZigLoadBSP {
         n3Indexs += grp.n3Indexs;
     }
 
-    const Vertex = extern struct {
-        pos: [3]f32,
-        tex: [2]f32,
+    const threads = par.threadCount(zigLoadOptions.threads);
+    var timer = try std.time.Timer.start();
+
+    // the lumps kept for the traces and culling do not depend on the
+    // geometry, they are done next to it
+    var kept = KeptLumps{
+        .clipnodes = clipnodes,
+        .planes = planes,
+        .nodes = nodes,
+        .leaves = leaves,
+        .marksurfs = marksurfs,
+        .visdata = visdata,
+        .models = models,
+        .inplace = inplace,
+        .relayout = zigLoadOptions.relayout != 0,
     };
+    errdefer kept.deinit();
+    var keeper: ?std.Thread = if (threads > 1) std.Thread.spawn(.{}, KeptLumps.run, .{&kept}) catch null else null;
+    errdefer if (keeper) |t| t.join();
+    if (keeper == null) kept.run();
 
-    // fill VBO and EBO content
-    const vbo = try alloc.alloc(Vertex, nVertexs);
+    // place every face in VBO and EBO, the vertices and indices are
+    // written by the emit stage below
+    const vbo = try alloc.alloc(ZigBSPVertex, nVertexs);
     errdefer alloc.free(vbo);
     const ebo = try alloc.alloc([3]u32, n3Indexs);
     errdefer alloc.free(ebo);
-    for (models) |mdl| {
-        for (faces[mdl.iFace0..][0..mdl.nFaces]) |face| {
+    const facedraw = try alloc.alloc(ZigBSPFace, faces.len);
+    errdefer alloc.free(facedraw);
+    @memset(std.mem.sliceAsBytes(facedraw), 0);
+    const faceVertex = try alloc.alloc(u32, faces.len);
+    defer alloc.free(faceVertex);
+    // models go one after another, so the faces of a model in a texture
+    // group are one range
+    var ranges = std.ArrayList(ZigBSPFace).init(alloc);
+    errdefer ranges.deinit();
+    const faceRange = try alloc.alloc(u32, faces.len);
+    defer alloc.free(faceRange);
+    @memset(faceRange, no_range);
+    const texRange = try alloc.alloc(u32, miptexoff.len);
+    defer alloc.free(texRange);
+    for (models, ldmodels) |mdl, *ldmdl| {
+        ldmdl.iRange0 = @intCast(ranges.items.len);
+        defer ldmdl.nRanges = @as(u32, @intCast(ranges.items.len)) - ldmdl.iRange0;
+        if (ldmdl.dropped != 0) continue;
+        @memset(texRange, no_range);
+        const mfaces = faces[mdl.iFace0..][0..mdl.nFaces];
+        for (mfaces, facedraw[mdl.iFace0..][0..mdl.nFaces], faceRange[mdl.iFace0..][0..mdl.nFaces], faceVertex[mdl.iFace0..][0..mdl.nFaces]) |face, *fdraw, *frange, *fvertex| {
             const texinfo = texinfos[face.iTexInfo];
             const txgroup = &texFaceGroup[texinfo.iMipTex];
-            const miptex = textures.getMipTex(miptexoff[texinfo.iMipTex]);
-            const iVertexX = txgroup.iVertexX;
             const i3IndexX = txgroup.i3IndexX;
+            fvertex.* = txgroup.iVertexX;
             txgroup.iVertexX += face.nEdges;
             txgroup.i3IndexX += face.nEdges - 2;
-            for (surfedges[face.iEdge0..][0..face.nEdges], iVertexX..) |surfedge, i| {
-                const abs = std.math.absCast(surfedge);
-                const ivt = edges[abs][@intFromBool(surfedge < 0)];
-                vbo[i] = .{
-                    .pos = vertices[ivt],
-                    .tex = texinfo.calcST(vertices[ivt], miptex.width, miptex.height),
-                };
+            fdraw.* = .{
+                .i3Index0 = i3IndexX,
+                .n3Indexs = face.nEdges - 2,
+                .iTexture = texinfo.iMipTex,
+            };
+            if (texRange[texinfo.iMipTex] == no_range) {
+                texRange[texinfo.iMipTex] = @intCast(ranges.items.len);
+                try ranges.append(.{ .i3Index0 = i3IndexX, .n3Indexs = 0, .iTexture = texinfo.iMipTex });
             }
-            for (2..face.nEdges, 1.., i3IndexX..) |a, b, i|
-                ebo[i] = .{
-                    iVertexX + 0,
-                    iVertexX + @as(u32, @intCast(a)),
-                    iVertexX + @as(u32, @intCast(b)),
-                };
+            frange.* = texRange[texinfo.iMipTex];
+            ranges.items[frange.*].n3Indexs += face.nEdges - 2;
         }
     }
 
-    // load textures
+    // every drawn face gets its place in the lightmap atlas, the emit
+    // stage writes the coordinates
+    const loaded = try alloc.alloc(bool, faces.len);
+    defer alloc.free(loaded);
+    for (loaded, faceRange) |*l, r| l.* = r != no_range;
+    var atlas = try lightmap.build(threads, .{
+        .faces = faces,
+        .texinfos = texinfos,
+        .surfedges = surfedges,
+        .edges = edges,
+        .vertices = vertices,
+        .lighting = lighting,
+        .loaded = loaded,
+    });
+    defer atlas.deinit();
+    errdefer alloc.free(atlas.pixels);
+
+    // load textures, pixel or index buffers and palettes are filled by
+    // the emit stage
     const ldtexs = try alloc.alloc(ZigBSPTex, miptexoff.len);
     errdefer {
-        for (ldtexs) |l| if (l.pixels) |p| alloc.free(p[0 .. l.width * l.height]);
+        for (ldtexs) |l| {
+            if (l.pixels) |p| alloc.free(p[0..mipPixelCount(l.width, l.height)]);
+            if (l.indexs) |p| alloc.free(p[0..mipPixelCount(l.width, l.height)]);
+        }
         alloc.free(ldtexs);
     }
     @memset(std.mem.sliceAsBytes(ldtexs), 0);
-    for (ldtexs, miptexoff, 0..) |*ldtex, mipoff, iMipTex| {
+    const palettes = try alloc.alloc([256][4]u8, if (paletted) miptexoff.len else 0);
+    errdefer alloc.free(palettes);
+    @memset(std.mem.sliceAsBytes(palettes), 0);
+    var texbytes: usize = palettes.len * @sizeOf([256][4]u8);
+    for (ldtexs, miptexoff) |*ldtex, mipoff| {
         const miptex = textures.getMipTex(mipoff);
         ldtex.width = miptex.width;
         ldtex.height = miptex.height;
-        const grp = texFaceGroup[iMipTex];
-        ldtex.i3Index0 = grp.i3Index0;
-        ldtex.n3Indexs = grp.n3Indexs;
-        const colors = miptex.getColors();
-        const indexs = miptex.getTexture(0).pixels;
-        const pixels = try alloc.alloc([4]u8, indexs.len);
-        errdefer alloc.free(pixels);
-        for (indexs, pixels) |i, *p| {
-            const c = colors[i];
-            const a = if (c[0] < 10 and c[1] < 10 and c[2] > 240) @as(u8, 0) else 255;
-            p.* = .{ c[0], c[1], c[2], a };
+        // no offsets: texture is in an external wad
+        if (miptex.offsets[0] != 0) {
+            const count = mipPixelCount(miptex.width, miptex.height);
+            if (paletted) {
+                ldtex.indexs = (try alloc.alloc(u8, count)).ptr;
+                texbytes += count;
+            } else {
+                ldtex.pixels = (try alloc.alloc([4]u8, count)).ptr;
+                texbytes += count * 4;
+            }
         }
-        ldtex.pixels = pixels.ptr;
         const txname = miptex.getName();
+        // decodeTexture looks at the texels, without them go by the name
+        ldtex.alpha = @intFromBool(std.mem.startsWith(u8, txname, "{"));
         if (std.ascii.eqlIgnoreCase(txname, "aaatrigger") or
             std.ascii.eqlIgnoreCase(txname, "sky")) ldtex.skipped = 1;
         _ = std.c.printf("texture: %s\n", &miptex._name);
     }
 
+    const emitter = Emitter{
+        .faces = faces,
+        .texinfos = texinfos,
+        .textures = textures,
+        .miptexoff = miptexoff,
+        .surfedges = surfedges,
+        .edges = edges,
+        .vertices = vertices,
+        .faceVertex = faceVertex,
+        .faceRange = faceRange,
+        .facedraw = facedraw,
+        .vbo = vbo,
+        .ebo = ebo,
+        .ldtexs = ldtexs,
+        .palettes = palettes,
+        .atlas = &atlas,
+    };
+    par.forEach(threads, emitter.jobs(), &emitter, Emitter.run);
+    const emit_ms = msSince(&timer);
+    _ = std.c.printf("texture data: %s, %zu bytes\n", if (paletted) "index" else "rgba", texbytes);
+
+    // weld and quantize, vertices and indices get smaller in place
+    var nVertexsOut = nVertexs;
+    var idx_size: u8 = 4;
+    var pos_scale: f32 = 1;
+    if (compact) {
+        const mesh = try compactMesh(vbo, ebo, texFaceGroup);
+        if (reorder) {
+            var reorder_timer = try std.time.Timer.start();
+            const before = try meshopt.acmr(ebo, texFaceGroup);
+            try meshopt.orderFaces(ebo, facedraw, ranges.items, faceRange, threads);
+            const after = try meshopt.acmr(ebo, texFaceGroup);
+            // every vertex misses once at least
+            const floor = @as(f64, @floatFromInt(mesh.nVertexs)) / @as(f64, @floatFromInt(@max(ebo.len, 1)));
+            _ = std.c.printf("vertex cache (%d entries): ACMR %.3f -> %.3f, floor %.3f, %.3f ms\n",
+                @as(c_int, meshopt.cache_size), before, after, floor, msSince(&reorder_timer));
+        }
+        idx_size = narrowIndices(ebo, mesh.maxgrp);
+        _ = std.c.printf("compact mesh: %u -> %u vertices, vbo %zu -> %zu bytes, ebo %zu -> %zu bytes\n", nVertexs, mesh.nVertexs,
+            vbo.len * @sizeOf(ZigBSPVertex), @as(usize, mesh.nVertexs) * @sizeOf(ZigBSPVertexQ),
+            ebo.len * @sizeOf([3]u32), ebo.len * 3 * @as(usize, idx_size));
+        nVertexsOut = mesh.nVertexs;
+        pos_scale = mesh.pos_scale;
+    }
+    const mesh_ms = msSince(&timer);
+
+    // index ranges of the texture groups, final after compactMesh
+    for (ldtexs, texFaceGroup) |*ldtex, grp| {
+        ldtex.i3Index0 = grp.i3Index0;
+        ldtex.n3Indexs = grp.n3Indexs;
+        ldtex.iVertex0 = grp.iVertexB;
+    }
+    const texarrs = try packTexArrays(ldtexs);
+    errdefer alloc.free(texarrs);
+
     for (models) |m|
         std.debug.print("{}\n", .{m});
 
-    // copy clipnodes
-    const ldclips = try alloc.alloc(bsp.ClipNode, clipnodes.len);
-    errdefer alloc.free(ldclips);
-    @memcpy(ldclips, clipnodes);
-
-    // copy planes
-    const ldplane = try alloc.alloc(bsp.Plane, planes.len);
-    errdefer alloc.free(ldplane);
-    @memcpy(ldplane, planes);
+    if (keeper) |t| t.join();
+    keeper = null;
+    if (kept.err) |e| return e;
+    const wait_ms = msSince(&timer);
+    _ = std.c.printf("nodes = %zu, leaves = %zu, visdata = %zu bytes\n", nodes.len, leaves.len, visdata.len);
+    _ = std.c.printf("clipnode maxdepth = %d\n", kept.maxdepth);
+    _ = std.c.printf("loader threads: %zu, faces and textures %.3f ms, mesh %.3f ms, lumps waited %.3f ms\n", threads, emit_ms, mesh_ms, wait_ms);
+    const ldclips = kept.ldclips;
+    const ldplane = kept.ldplane;
+    const ldnodes = kept.ldnodes;
+    const ldleafs = kept.ldleafs;
+    const ldmarks = kept.ldmarks;
+    const ldvisdt = kept.ldvisdt;
+    const hulls = kept.hulls.?;
 
-    var maxdepth: u32 = 0;
-    for (models) |mdl| {
-        for (mdl.iHeadnodes[1..4]) |hn| {
-            maxdepth = @max(maxdepth, recurseClipNode(ldclips.ptr, hn));
-        }
-    }
-    _ = std.c.printf("clipnode maxdepth = %d\n", maxdepth);
+    const ldranges = try ranges.toOwnedSlice();
 
-    // return as bytes
+    // return as bytes, without what compactMesh freed up
+    keepmap = inplace;
+    const vbo_size = nVertexsOut * @as(usize, if (compact) @sizeOf(ZigBSPVertexQ) else @sizeOf(ZigBSPVertex));
+    const ebo_size = ebo.len * 3 * @as(usize, idx_size);
     const vbo_data = std.mem.sliceAsBytes(vbo);
     const ebo_data = std.mem.sliceAsBytes(ebo);
+    _ = alloc.resize(vbo_data, vbo_size);
+    _ = alloc.resize(ebo_data, ebo_size);
     return .{
         .vbo_data = vbo_data.ptr,
-        .vbo_size = vbo_data.len,
+        .vbo_size = vbo_size,
         .ebo_data = ebo_data.ptr,
-        .ebo_size = ebo_data.len,
+        .ebo_size = ebo_size,
         .textures = ldtexs.ptr,
         .text_cnt = ldtexs.len,
         .clipnode = ldclips.ptr,
@@ -213,9 +594,298 @@ fn loadBSP(i_filename: [*:0]const u8) anyerror!ZigLoadBSP {
         .world_h3 = models[0].iHeadnodes[3],
         .b_planes = ldplane.ptr,
         .planecnt = ldplane.len,
+        .world_h0 = models[0].iHeadnodes[0],
+        .nodes = ldnodes.ptr,
+        .nodecnt = ldnodes.len,
+        .leaves = ldleafs.ptr,
+        .leafcnt = ldleafs.len,
+        .visleafs = models[0].nVisLeafs,
+        .marksurf = ldmarks.ptr,
+        .markcnt = ldmarks.len,
+        .visdata = ldvisdt.ptr,
+        .vis_size = ldvisdt.len,
+        .facedraw = facedraw.ptr,
+        .face_cnt = facedraw.len,
+        .world_nf = models[0].nFaces,
+        .mapping = if (inplace) mapping.?.ptr else null,
+        .map_size = if (inplace) mapping.?.len else 0,
+        .texarrs = texarrs.ptr,
+        .tarr_cnt = texarrs.len,
+        .cached = 0,
+        .vtx_fmt = if (compact) vtx_quant else vtx_float,
+        .idx_size = idx_size,
+        .tex_fmt = if (paletted) tex_index else tex_rgba,
+        .pos_scale = pos_scale,
+        .models = ldmodels.ptr,
+        .model_cnt = ldmodels.len,
+        .ranges = ldranges.ptr,
+        .range_cnt = ldranges.len,
+        .hullnode = hulls.nodes.ptr,
+        .hnode_cnt = hulls.nodes.len,
+        .hroot = hulls.roots,
+        .palettes = palettes.ptr,
+        .pal_cnt = palettes.len,
+        .lightmap = atlas.pixels.ptr,
+        .lm_size = atlas.pixels.len,
+        .lm_width = atlas.width,
+        .lm_height = atlas.height,
+        .grids = null,
     };
 }
 
+const no_range = std.math.maxInt(u32);
+
+/// faces written by one job of the emit stage
+const face_chunk = 256;
+
+/// the emit stage: decode every texture and write the vertices and
+/// triangles of the placed faces, chunk by chunk; every job writes its own
+/// part of the output, so they all run at the same time
+const Emitter = struct {
+    faces: []align(1) const bsp.Face,
+    texinfos: []align(1) const bsp.TexInfo,
+    textures: *align(1) const bsp.TextureLump,
+    miptexoff: []align(1) const u32,
+    surfedges: []align(1) const bsp.SurfEdge,
+    edges: []align(1) const bsp.Edge,
+    vertices: []align(1) const bsp.VertexLump,
+    faceVertex: []const u32, // first vertex of every placed face
+    faceRange: []const u32, // no_range if the face is not loaded
+    facedraw: []const ZigBSPFace,
+    vbo: []ZigBSPVertex,
+    ebo: [][3]u32,
+    ldtexs: []ZigBSPTex,
+    palettes: [][256][4]u8, // empty unless paletted
+    atlas: *const lightmap.Atlas,
+
+    fn jobs(self: *const Emitter) usize {
+        return self.ldtexs.len + (self.faces.len + face_chunk - 1) / face_chunk;
+    }
+
+    /// textures first, they are the largest jobs
+    fn run(self: *const Emitter, worker: usize, job: usize) void {
+        _ = worker;
+        if (job < self.ldtexs.len)
+            return decodeTexture(self.textures.getMipTex(self.miptexoff[job]), &self.ldtexs[job], if (self.palettes.len != 0) &self.palettes[job] else null);
+        const f0 = (job - self.ldtexs.len) * face_chunk;
+        for (f0..@min(f0 + face_chunk, self.faces.len)) |f|
+            if (self.faceRange[f] != no_range) self.emitFace(f);
+    }
+
+    fn emitFace(self: *const Emitter, f: usize) void {
+        const face = self.faces[f];
+        const texinfo = self.texinfos[face.iTexInfo];
+        const miptex = self.textures.getMipTex(self.miptexoff[texinfo.iMipTex]);
+        const iVertexX = self.faceVertex[f];
+        const i3IndexX = self.facedraw[f].i3Index0;
+        for (self.surfedges[face.iEdge0..][0..face.nEdges], iVertexX..) |surfedge, i| {
+            const abs = std.math.absCast(surfedge);
+            const ivt = self.edges[abs][@intFromBool(surfedge < 0)];
+            self.vbo[i] = .{
+                .pos = self.vertices[ivt],
+                .tex = texinfo.calcST(self.vertices[ivt], miptex.width, miptex.height),
+                .lm = self.atlas.uv(f, texinfo, self.vertices[ivt]),
+            };
+        }
+        // textures repeat, so move the face to the first repetition, this
+        // keeps the coordinates small enough for half floats
+        const fverts = self.vbo[iVertexX..][0..face.nEdges];
+        for (0..2) |c| {
+            var lo = fverts[0].tex[c];
+            for (fverts[1..]) |v| lo = @min(lo, v.tex[c]);
+            const shift = @floor(lo);
+            for (fverts) |*v| v.tex[c] -= shift;
+        }
+        for (2..face.nEdges, 1.., i3IndexX..) |a, b, i|
+            self.ebo[i] = .{
+                iVertexX + 0,
+                iVertexX + @as(u32, @intCast(a)),
+                iVertexX + @as(u32, @intCast(b)),
+            };
+    }
+};
+
+/// clipnodes, planes, render tree and visibility as they are in the file,
+/// and the hull copy of hullopt; none of it needs the geometry, so it runs
+/// on its own thread next to the emit stage
+const KeptLumps = struct {
+    clipnodes: []align(1) const bsp.ClipNode,
+    planes: []align(1) const bsp.Plane,
+    nodes: []align(1) const bsp.Node,
+    leaves: []align(1) const bsp.Leaf,
+    marksurfs: []align(1) const u16,
+    visdata: []const u8,
+    models: []align(1) const bsp.Model,
+    inplace: bool,
+    relayout: bool,
+    ldclips: []bsp.ClipNode = &.{},
+    ldplane: []bsp.Plane = &.{},
+    ldnodes: []bsp.Node = &.{},
+    ldleafs: []bsp.Leaf = &.{},
+    ldmarks: []u16 = &.{},
+    ldvisdt: []u8 = &.{},
+    hulls: ?hullopt.Hulls = null,
+    maxdepth: u32 = 0,
+    err: ?anyerror = null,
+
+    fn run(self: *KeptLumps) void {
+        self.keep() catch |e| {
+            self.err = e;
+        };
+    }
+
+    fn keep(self: *KeptLumps) !void {
+        self.ldclips = try keepLump(bsp.ClipNode, self.clipnodes, self.inplace);
+        self.ldplane = try keepLump(bsp.Plane, self.planes, self.inplace);
+        self.ldnodes = try keepLump(bsp.Node, self.nodes, self.inplace);
+        self.ldleafs = try keepLump(bsp.Leaf, self.leaves, self.inplace);
+        self.ldmarks = try keepLump(u16, self.marksurfs, self.inplace);
+        self.ldvisdt = try keepLump(u8, self.visdata, self.inplace);
+        for (self.models) |mdl| {
+            for (mdl.iHeadnodes[1..4]) |hn| {
+                self.maxdepth = @max(self.maxdepth, recurseClipNode(self.ldclips.ptr, hn));
+            }
+        }
+        self.hulls = try hullopt.build(self.ldclips, self.ldplane, self.models[0].iHeadnodes[1..4].*, self.relayout);
+    }
+
+    fn deinit(self: *KeptLumps) void {
+        if (self.hulls) |h| alloc.free(h.nodes);
+        dropLump(self.ldclips, self.inplace);
+        dropLump(self.ldplane, self.inplace);
+        dropLump(self.ldnodes, self.inplace);
+        dropLump(self.ldleafs, self.inplace);
+        dropLump(self.ldmarks, self.inplace);
+        dropLump(self.ldvisdt, self.inplace);
+    }
+};
+
+/// classes of brush entities that are never drawn, besides trigger_*
+const invisible_classes = [_][]const u8{
+    "func_ladder",
+    "func_friction",
+    "func_monsterclip",
+    "func_buyzone",
+    "func_bomb_target",
+    "func_hostage_rescue",
+    "func_vip_safetyzone",
+    "func_escapezone",
+    "game_zone_player",
+};
+
+fn isInvisible(ent: bsp.Entity) bool {
+    const classname = ent.get("classname") orelse "";
+    if (std.mem.startsWith(u8, classname, "trigger_")) return true;
+    for (invisible_classes) |c|
+        if (std.mem.eql(u8, classname, c)) return true;
+    // any rendermode but normal with renderamt 0 is fully transparent
+    const mode = std.fmt.parseInt(i32, ent.get("rendermode") orelse "0", 10) catch 0;
+    const amt = std.fmt.parseInt(i32, ent.get("renderamt") orelse "255", 10) catch 255;
+    return mode != 0 and amt == 0;
+}
+
+/// bounds and faces of every model, models of invisible entities are
+/// dropped, returns how many
+fn loadModels(ldmodels: []ZigBSPModel, models: []align(1) const bsp.Model, entities: []const u8) u32 {
+    for (ldmodels, models) |*ldmdl, mdl| {
+        ldmdl.* = .{
+            .mins = undefined,
+            .maxs = undefined,
+            .iFace0 = mdl.iFace0,
+            .nFaces = mdl.nFaces,
+            .iRange0 = 0,
+            .nRanges = 0,
+            .dropped = 0,
+        };
+        for (&ldmdl.mins, mdl.mins) |*o, x| o.* = @intFromFloat(std.math.clamp(@floor(x), -32768, 32767));
+        for (&ldmdl.maxs, mdl.maxs) |*o, x| o.* = @intFromFloat(std.math.clamp(@ceil(x), -32768, 32767));
+    }
+    var ndropped: u32 = 0;
+    var lump = bsp.EntityLump.init(entities);
+    while (lump.next()) |ent| {
+        // brush entities refer to their model as "*index"
+        const model = ent.get("model") orelse continue;
+        if (model.len < 2 or model[0] != '*') continue;
+        const i = std.fmt.parseInt(usize, model[1..], 10) catch continue;
+        if (i == 0 or i >= ldmodels.len or ldmodels[i].dropped != 0) continue;
+        if (isInvisible(ent)) {
+            ldmodels[i].dropped = 1;
+            ndropped += 1;
+        }
+    }
+    return ndropped;
+}
+
+fn quantize(v: ZigBSPVertex, steps: f32) ZigBSPVertexQ {
+    var q = ZigBSPVertexQ{ .pos = undefined, .tex = undefined, .lm = undefined };
+    for (&q.pos, v.pos) |*p, x| p.* = @intFromFloat(@round(x * steps));
+    for (&q.tex, v.tex) |*t, x| t.* = @bitCast(@as(f16, @floatCast(x)));
+    for (&q.lm, v.lm) |*l, x| l.* = @intFromFloat(@round(std.math.clamp(x, 0, 1) * 65535));
+    return q;
+}
+
+/// Weld vertices that are equal after quantization inside each texture
+/// group, in place: vbo becomes ZigBSPVertexQ, ebo becomes indices relative
+/// to the first vertex of the group, see narrowIndices.
+///
+/// Positions use the finest power of two step that fits the map in i16,
+/// 1/4 unit for a +-4096 map, so shared vertices stay shared. Lit faces
+/// span at most 256 texels (the lightmap extents the engine allows, see
+/// lightmap.zig) and start at the first repetition of the texture, half
+/// floats are within 1/4 texel there; unlit special faces such as water
+/// and sky may span more and get coarser. Lightmap coordinates are 1/16
+/// luxel or better, atlases are at most lightmap.max_side luxels; they
+/// differ from face to face, so only vertices inside one face weld.
+fn compactMesh(vbo: []ZigBSPVertex, ebo: [][3]u32, groups: anytype) !struct { nVertexs: u32, maxgrp: u32, pos_scale: f32 } {
+    var maxabs: f32 = 1;
+    for (vbo) |v| for (v.pos) |x| {
+        maxabs = @max(maxabs, @fabs(x));
+    };
+    const steps = @exp2(@floor(@log2(32767 / maxabs)));
+
+    const remap = try alloc.alloc(u32, vbo.len);
+    defer alloc.free(remap);
+    var welded = std.AutoHashMap(ZigBSPVertexQ, u32).init(alloc);
+    defer welded.deinit();
+
+    // output vertex n is written after input vertex i >= n is read, and
+    // is smaller, so it never overwrites vertices still to be read
+    const out: [*]ZigBSPVertexQ = @ptrCast(vbo.ptr);
+    var n: u32 = 0;
+    var maxgrp: u32 = 0;
+    for (groups) |*grp| {
+        welded.clearRetainingCapacity();
+        grp.iVertexB = n;
+        for (grp.iVertex0..grp.iVertex0 + grp.nVertexs) |i| {
+            const q = quantize(vbo[i], steps);
+            const entry = try welded.getOrPut(q);
+            if (!entry.found_existing) {
+                entry.value_ptr.* = n - grp.iVertexB;
+                out[n] = q;
+                n += 1;
+            }
+            remap[i] = entry.value_ptr.*;
+        }
+        maxgrp = @max(maxgrp, n - grp.iVertexB);
+    }
+
+    for (ebo) |*t| for (t) |*i| {
+        i.* = remap[i.*];
+    };
+    return .{ .nVertexs = n, .maxgrp = maxgrp, .pos_scale = 1 / steps };
+}
+
+/// u16 indices in place if every group has 65536 vertices or less,
+/// returns the index size
+fn narrowIndices(ebo: [][3]u32, maxgrp: u32) u8 {
+    if (maxgrp > 65536) return 4;
+    // narrow ones are written over wide ones already read
+    const wide: [*]const u32 = @ptrCast(ebo.ptr);
+    const narrow: [*]u16 = @ptrCast(ebo.ptr);
+    for (0..ebo.len * 3) |k| narrow[k] = @intCast(wide[k]);
+    return 2;
+}
+
 fn recurseClipNode(nodes: [*]bsp.ClipNode, root: i32) u32 {
     var maxDepth: u32 = 0;
     if (root < 0) return 1;
@@ -223,3 +893,79 @@ fn recurseClipNode(nodes: [*]bsp.ClipNode, root: i32) u32 {
     maxDepth = @max(maxDepth, recurseClipNode(nodes, nodes[@intCast(root)].iChildren[1]));
     return maxDepth + 1;
 }
+
+/// put each texture into the first array of its size that is not full
+fn packTexArrays(ldtexs: []ZigBSPTex) ![]ZigBSPTexArr {
+    var texarrs = std.ArrayList(ZigBSPTexArr).init(alloc);
+    errdefer texarrs.deinit();
+    for (ldtexs) |*ldtex| {
+        const i = for (texarrs.items, 0..) |a, j| {
+            if (a.width == ldtex.width and a.height == ldtex.height and a.layers < max_layers) break j;
+        } else blk: {
+            try texarrs.append(.{ .width = ldtex.width, .height = ldtex.height, .layers = 0 });
+            break :blk texarrs.items.len - 1;
+        };
+        ldtex.texarr = @intCast(i);
+        ldtex.layer = @intCast(texarrs.items[i].layers);
+        texarrs.items[i].layers += 1;
+    }
+    _ = std.c.printf("texture arrays: %zu\n", texarrs.items.len);
+    return texarrs.toOwnedSlice();
+}
+
+pub fn mipPixelCount(width: u32, height: u32) usize {
+    var count: usize = 0;
+    for (0..4) |l| count += (width >> @intCast(l)) * (height >> @intCast(l));
+    return count;
+}
+
+/// palette as little-endian rgba, with the blue key already turned into alpha
+fn keyedPalette(colors: *const [256][3]u8) [256]u32 {
+    var palette: [256]u32 = undefined;
+    for (&palette, colors) |*p, c| {
+        const a: u32 = if (c[0] < 10 and c[1] < 10 and c[2] > 240) 0 else 255;
+        p.* = @as(u32, c[0]) | @as(u32, c[1]) << 8 | @as(u32, c[2]) << 16 | a << 24;
+    }
+    return palette;
+}
+
+/// one table load and store per pixel, unrolled, no branches
+fn expandIndices(palette: *const [256]u32, indexs: []const u8, out: [*]u32) void {
+    const N = 16;
+    var i: usize = 0;
+    while (i + N <= indexs.len) : (i += N) {
+        const chunk: [N]u8 = indexs[i..][0..N].*;
+        inline for (0..N) |k| out[i + k] = palette[chunk[k]];
+    }
+    while (i < indexs.len) : (i += 1) out[i] = palette[indexs[i]];
+}
+
+/// expand all mip levels, or copy their indices and the palette for
+/// tex_index, and tag the texture alpha-tested if a texel of the first
+/// level is keyed out
+fn decodeTexture(miptex: *align(1) const bsp.MipTex, ldtex: *ZigBSPTex, palette_out: ?*[256][4]u8) void {
+    if (ldtex.pixels == null and ldtex.indexs == null) return;
+    const palette = keyedPalette(miptex.getColors());
+    var used = [_]bool{false} ** 256;
+    for (miptex.getTexture(0).pixels) |i| used[i] = true;
+    ldtex.alpha = 0;
+    for (palette, used) |p, u| {
+        if (u and p >> 24 == 0) ldtex.alpha = 1;
+    }
+    if (ldtex.indexs) |indexs_out| {
+        std.mem.asBytes(palette_out.?).* = std.mem.asBytes(&palette).*;
+        var out = indexs_out;
+        for (0..4) |l| {
+            const indexs = miptex.getTexture(@intCast(l)).pixels;
+            @memcpy(out[0..indexs.len], indexs);
+            out += indexs.len;
+        }
+        return;
+    }
+    var out: [*]u32 = @ptrCast(@alignCast(ldtex.pixels.?));
+    for (0..4) |l| {
+        const indexs = miptex.getTexture(@intCast(l)).pixels;
+        expandIndices(&palette, indexs, out);
+        out += indexs.len;
+    }
+}
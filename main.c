@@ -3,198 +3,20 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #define CGLM_DEFINE_PRINTS
 #include <cglm/cglm.h>
-
-typedef struct {
-    uint32_t width;
-    uint32_t height;
-    uint32_t i3Index0;
-    uint32_t n3Indexs;
-    uint8_t (*pixels)[4];
-    uint8_t skipped;
-} ZigBSPTex;
-
-typedef struct {
-    vec3 n;
-    float d;
-    int32_t type;
-} plane_t;
-
-typedef struct {
-    uint32_t iPlane;
-    int16_t iChilds[2];
-} clipnode_t;
-
-typedef struct {
-    uint8_t *vbo_data;
-    size_t vbo_size;
-    uint8_t *ebo_data;
-    size_t ebo_size;
-    ZigBSPTex *textures;
-    size_t text_cnt;
-    clipnode_t *clipnode;
-    size_t clip_cnt;
-    int32_t hull[3];
-    plane_t *planes;
-    size_t planecnt;
-} ZigLoadBSP;
-
-int32_t traverseBSP(ZigLoadBSP *bsp, int32_t node, float pos[3], float *out_normal) {
-    if (node < 0) {
-        if (out_normal)
-            glm_vec3_zero(out_normal);
-        return node;
-    }
-    while (true) {
-        clipnode_t c = bsp->clipnode[node];
-        plane_t p = bsp->planes[c.iPlane];
-        bool side = glm_vec3_dot(p.n, pos) - p.d > 0.0;
-        if (side)
-            node = c.iChilds[0];
-        else
-            node = c.iChilds[1];
-        if (node < 0) {
-            if (out_normal) {
-                glm_vec3_copy(p.n, out_normal);
-                if (!side)
-                    glm_vec3_negate(out_normal);
-            }
-            return node;
-        }
-    }
-}
-
-// copied from Xash3D
-
-typedef struct {
-    bool allsolid;
-    bool startsolid;
-    bool inopen, inwater;
-    float fraction;
-    vec3 endpos;
-    plane_t plane;
-    int ent;
-    vec3 deltavelocity;
-    int hitgroup;
-} pmtrace_t;
-
-// #define DIST_EPS (1.0f / 32.0f)
-#define DIST_EPSILON FLT_EPSILON
-#define CONTENTS_EMPTY -1
-#define CONTENTS_SOLID -2
-
-int32_t PM_HullPointContents(ZigLoadBSP *bsp, int32_t num, vec3 pos) {
-    while (num >= 0) {
-        clipnode_t c = bsp->clipnode[num];
-        plane_t p = bsp->planes[c.iPlane];
-        num = c.iChilds[glm_vec3_dot(p.n, pos) - p.d < 0];
-    }
-    return num;
-}
-bool PM_RecursiveHullCheck(ZigLoadBSP *hull, int root, int num, float p1f, float p2f, vec3 p1, vec3 p2, pmtrace_t *trace) {
-    clipnode_t *node;
-    plane_t *plane;
-    float t1, t2;
-    float frac, midf;
-    int side;
-    vec3 mid;
-loc0:
-    // check for empty
-    if (num < 0) {
-        if (num != CONTENTS_SOLID) {
-            trace->allsolid = false;
-            if (num == CONTENTS_EMPTY)
-                trace->inopen = true;
-            else
-                trace->inwater = true;
-        } else
-            trace->startsolid = true;
-        return true; // empty
-    }
-
-    // find the point distances
-    node = hull->clipnode + num;
-    plane = hull->planes + node->iPlane;
-
-    t1 = glm_vec3_dot(p1, plane->n) - plane->d; // PlaneDiff(p1, plane);
-    t2 = glm_vec3_dot(p2, plane->n) - plane->d; // PlaneDiff(p2, plane);
-
-    if (t1 >= 0.0f && t2 >= 0.0f) {
-        num = node->iChilds[0];
-        goto loc0;
-    }
-
-    if (t1 < 0.0f && t2 < 0.0f) {
-        num = node->iChilds[1];
-        goto loc0;
-    }
-
-    // put the crosspoint DIST_EPSILON pixels on the near side
-    side = (t1 < 0.0f);
-
-    if (side)
-        frac = (t1 + DIST_EPSILON) / (t1 - t2);
-    else
-        frac = (t1 - DIST_EPSILON) / (t1 - t2);
-
-    if (frac < 0.0f)
-        frac = 0.0f;
-    if (frac > 1.0f)
-        frac = 1.0f;
-
-    midf = p1f + (p2f - p1f) * frac;
-    glm_vec3_lerp(p1, p2, frac, mid); // VectorLerp(p1, frac, p2, mid);
-
-    // move up to the node
-    if (!PM_RecursiveHullCheck(hull, root, node->iChilds[side], p1f, midf, p1, mid, trace))
-        return false;
-
-    // this recursion can not be optimized because mid would need to be duplicated on a stack
-    if (PM_HullPointContents(hull, node->iChilds[side ^ 1], mid) != CONTENTS_SOLID) {
-        // go past the node
-        return PM_RecursiveHullCheck(hull, root, node->iChilds[side ^ 1], midf, p2f, mid, p2, trace);
-    }
-
-    // never got out of the solid area
-    if (trace->allsolid)
-        return false;
-
-    // the other side of the node is solid, this is the impact point
-    if (!side) {
-        glm_vec3_copy(plane->n, trace->plane.n);
-        trace->plane.d = plane->d;
-    } else {
-        glm_vec3_copy(plane->n, trace->plane.n);
-        glm_vec3_negate(trace->plane.n);
-        trace->plane.d = -plane->d;
-    }
-
-    while (PM_HullPointContents(hull, root, mid) == CONTENTS_SOLID) {
-        // shouldn't really happen, but does occasionally
-        frac -= 0.1f;
-
-        if (frac < 0.0f) {
-            trace->fraction = midf;
-            glm_vec3_copy(mid, trace->endpos);
-            // fprintf(stderr, "trace backed up past 0.0\n");
-            return false;
-        }
-
-        midf = p1f + (p2f - p1f) * frac;
-        glm_vec3_lerp(p1, p2, frac, mid); // VectorLerp(p1, frac, p2, mid);
-    }
-
-    trace->fraction = midf;
-    glm_vec3_copy(mid, trace->endpos);
-
-    return false;
-}
-
-int32_t zigLoadBSP(const char *filename, ZigLoadBSP *result);
-void zigFreeBSP(ZigLoadBSP *result);
+#include "bsp.h"
+#include "demo.h"
+#include "player.h"
+#include "server.h"
+#include "prof.h"
+#include "mapload.h"
+#include "render.h"
+#include "bench.h"
+#include "sim.h"
 
 static void cbGlfwError(int error, const char *description) {
     fprintf(stderr, "GLFW Error %d: %s\n", error, description);
@@ -204,32 +26,44 @@ static void cbGLDebug(GLenum source, GLenum type, GLuint id, GLenum severity, GL
     fprintf(stderr, "GL Debug: %s\n", message);
 }
 
+// state of the input thread, the one with the window: movement goes to
+// the simulation as events, the render toggles are flags the render
+// thread reads every frame
 typedef struct _userdata {
-    ZigLoadBSP *bsp;
+    sim_t *sim;
     bool captured;
     double prev_xpos;
     double prev_ypos;
-    vec3 pos;
+    atomic_bool frustum; // enable frustum culling
+    atomic_bool models;  // draw brush models
+    atomic_bool prepass; // depth pre-pass
+    atomic_bool nextMap; // load the next map of the list
+    // the view as the simulation will have it, the camera takes it from
+    // here so a mouse move shows in the next frame, not after a tick
     vec3 ang;
-    vec3 vel;
-    bool w;      // forward
-    bool s;      // back
-    bool a;      // moveleft
-    bool d;      // moveright
-    bool c;      // duck
-    bool j;      // jump
-    bool su;     // scroll up
-    bool sd;     // scroll dn
-    bool bPrevJ; // pressed jump
-    bool bGround;
-    bool bDucked; // ducked
-    bool bInDuck; // duck transition
-    bool bNoclip;
-    float flDuckAmount;
-    vec3 jumpOff;
-    int hull;
+    _Atomic uint64_t view; // yaw and pitch of ang, the bits of two floats
 } userdata_t;
 
+static void viewStore(userdata_t *ud) {
+    uint32_t yaw, pitch;
+    memcpy(&yaw, &ud->ang[0], sizeof(yaw));
+    memcpy(&pitch, &ud->ang[1], sizeof(pitch));
+    atomic_store_explicit(&ud->view, (uint64_t)pitch << 32 | yaw, memory_order_relaxed);
+}
+
+static void viewLoad(userdata_t *ud, vec3 ang) {
+    uint64_t bits = atomic_load_explicit(&ud->view, memory_order_relaxed);
+    uint32_t yaw = (uint32_t)bits, pitch = (uint32_t)(bits >> 32);
+    memcpy(&ang[0], &yaw, sizeof(yaw));
+    memcpy(&ang[1], &pitch, sizeof(pitch));
+    ang[2] = 0.0f;
+}
+
+static void pushButton(userdata_t *ud, uint16_t button, bool down) {
+    inputevent_t ev = {.time = simTime(), .kind = IN_BUTTON, .button = button, .down = down};
+    inputPush(&ud->sim->input, &ev);
+}
+
 static void setCapture(GLFWwindow *window, userdata_t *ud, bool capture) {
     if (ud->captured == capture)
         return;
@@ -238,14 +72,15 @@ static void setCapture(GLFWwindow *window, userdata_t *ud, bool capture) {
         glfwGetCursorPos(window, &ud->prev_xpos, &ud->prev_ypos);
     } else
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
-    ud->w = false;
-    ud->s = false;
-    ud->a = false;
-    ud->d = false;
-    ud->c = false;
-    ud->j = false;
-    ud->su = false;
-    ud->sd = false;
+    inputevent_t ev = {.time = simTime(), .kind = IN_RELEASE};
+    inputPush(&ud->sim->input, &ev);
+}
+
+// flip a render toggle, only this thread writes them
+static bool toggle(atomic_bool *flag) {
+    bool on = !atomic_load_explicit(flag, memory_order_relaxed);
+    atomic_store_explicit(flag, on, memory_order_relaxed);
+    return on;
 }
 
 static void cbGLFWKey(GLFWwindow *window, int key, int scancode, int action, int mods) {
@@ -253,36 +88,57 @@ static void cbGLFWKey(GLFWwindow *window, int key, int scancode, int action, int
         return;
     userdata_t *ud = (userdata_t *)glfwGetWindowUserPointer(window);
     bool pressed = action == GLFW_PRESS;
+    bool down = pressed && ud->captured;
     switch (key) {
     case GLFW_KEY_P:
         if (pressed) {
+            snapshot_t snap;
+            snapshotRead(&ud->sim->snaps, &snap);
             fprintf(stderr, "pos:\n");
-            glm_vec3_print(ud->pos, stderr);
+            glm_vec3_print(snap.pl.pos, stderr);
         }
         break;
+    case GLFW_KEY_F:
+        if (pressed)
+            fprintf(stderr, "frustum culling: %d\n", toggle(&ud->frustum));
+        break;
+    case GLFW_KEY_B:
+        if (pressed)
+            fprintf(stderr, "brush models: %d\n", toggle(&ud->models));
+        break;
+    case GLFW_KEY_Z:
+        if (pressed)
+            fprintf(stderr, "depth pre-pass: %d\n", toggle(&ud->prepass));
+        break;
+    case GLFW_KEY_N:
+        if (pressed)
+            atomic_store_explicit(&ud->nextMap, true, memory_order_relaxed);
+        break;
     case GLFW_KEY_V:
-        ud->bNoclip = pressed && ud->captured;
+        pushButton(ud, BTN_NOCLIP, down);
         break;
     case GLFW_KEY_W:
-        ud->w = pressed && ud->captured;
+        pushButton(ud, BTN_FORWARD, down);
         break;
     case GLFW_KEY_S:
-        ud->s = pressed && ud->captured;
+        pushButton(ud, BTN_BACK, down);
         break;
     case GLFW_KEY_A:
-        if ((ud->a = pressed && ud->captured))
-            ud->d = false;
+        pushButton(ud, BTN_LEFT, down);
+        if (down)
+            pushButton(ud, BTN_RIGHT, false);
         break;
     case GLFW_KEY_D:
-        if ((ud->d = pressed && ud->captured))
-            ud->a = false;
+        pushButton(ud, BTN_RIGHT, down);
+        if (down)
+            pushButton(ud, BTN_LEFT, false);
         break;
     case GLFW_KEY_LEFT_SHIFT:
-        ud->c = pressed && ud->captured;
+        pushButton(ud, BTN_DUCK, down);
         break;
     case GLFW_KEY_SPACE:
-        ud->j = pressed && ud->captured;
-        ud->w = false;
+        pushButton(ud, BTN_JUMP, down);
+        pushButton(ud, BTN_FORWARD, false);
         break;
     case GLFW_KEY_ESCAPE:
         setCapture(window, ud, false);
@@ -296,12 +152,8 @@ static void cbGLFWKey(GLFWwindow *window, int key, int scancode, int action, int
 
 static void cbGLFWScr(GLFWwindow *window, double xoffset, double yoffset) {
     userdata_t *ud = (userdata_t *)glfwGetWindowUserPointer(window);
-    if (ud->captured) {
-        if (yoffset > 0)
-            ud->su = true;
-        else
-            ud->sd = true;
-    }
+    if (ud->captured)
+        pushButton(ud, yoffset > 0 ? BTN_SCROLLUP : BTN_SCROLLDN, true);
 }
 
 static void cbGLFWPos(GLFWwindow *window, double xpos, double ypos) {
@@ -312,13 +164,12 @@ static void cbGLFWPos(GLFWwindow *window, double xpos, double ypos) {
     double ymove = ypos - ud->prev_ypos;
     ud->prev_xpos = xpos;
     ud->prev_ypos = ypos;
-    ud->ang[0] -= xmove * 0.022 * 4.5;
-    ud->ang[1] += ymove * 0.022 * 4.5;
-    if (ud->ang[0] >= 180.0)
-        ud->ang[0] -= 360.0;
-    if (ud->ang[0] < -180.0)
-        ud->ang[0] += 360.0;
-    ud->ang[1] = glm_clamp(ud->ang[1], -89.0, +89.0);
+    inputevent_t ev = {.time = simTime(), .kind = IN_LOOK, .yaw = -xmove * 0.022 * 4.5, .pitch = ymove * 0.022 * 4.5};
+    // a dropped event never reaches the simulation, so not the camera either
+    if (inputPush(&ud->sim->input, &ev)) {
+        lookAdd(ud->ang, ev.yaw, ev.pitch);
+        viewStore(ud);
+    }
 }
 
 static void cbGLFWBtn(GLFWwindow *window, int button, int action, int mods) {
@@ -341,233 +192,364 @@ static void cbGLFWFocus(GLFWwindow *window, int focused) {
         setCapture(window, ud, false);
 }
 
-char *readFile(const char *filename) {
-    FILE *fp = fopen(filename, "rb");
-    fseek(fp, 0, SEEK_END);
-    long len = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    char *data = malloc(len + 1);
-    fread(data, 1, len, fp);
-    data[len] = '\0';
-    fclose(fp);
-    return data;
+// seconds, without GLFW for headless runs
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
 }
 
-static void angle_vectors(vec3 degs, float *f, float *s, float *u) {
-    float y = glm_rad(degs[0]);
-    float p = glm_rad(degs[1]);
-    float r = glm_rad(degs[2]);
-    float sr = sin(r), sp = sin(p), sy = sin(y);
-    float cr = cos(r), cp = cos(p), cy = cos(y);
-    if (f) {
-        f[0] = cp * cy;
-        f[1] = cp * sy;
-        f[2] = -sp;
-    }
-    if (s) {
-        s[0] = -sr * sp * cy + cr * sy;
-        s[1] = -sr * sp * sy - cr * cy;
-        s[2] = -sr * cp;
-    }
-    if (u) {
-        u[0] = cr * sp * cy + sr * sy;
-        u[1] = cr * sp * sy - sr * cy;
-        u[2] = cr * cp;
+// re-run a demo without a window, repeat times, and check the final state
+static int replayDemo(ZigLoadBSP *bsp, const char *filename, int repeat) {
+    bool same = true;
+    uint64_t ticks = 0, traces = 0;
+    double start = now();
+    for (int r = 0; r < repeat; r++) {
+        demo_t demo;
+        if (!demoPlay(&demo, filename)) {
+            fprintf(stderr, "can not play demo %s\n", filename);
+            return 1;
+        }
+        player_t pl;
+        memset(&pl, 0, sizeof(pl));
+        usercmd_t cmd;
+        while (demoRead(&demo, &cmd)) {
+            player_move(bsp, &pl, &cmd, 1.0f / demo.tickrate);
+            ticks++;
+        }
+        traces += pl.nTraces;
+        if (demo.played != demo.ticks)
+            fprintf(stderr, "demo is truncated at tick %u of %u\n", demo.played, demo.ticks);
+        vec3 pos, vel;
+        same = demoClose(&demo, pos, vel) && same && demo.played == demo.ticks &&
+               memcmp(pos, pl.pos, sizeof(vec3)) == 0 && memcmp(vel, pl.vel, sizeof(vec3)) == 0;
     }
+    double secs = now() - start;
+    if (ticks == 0)
+        ticks = 1;
+    printf("replay: %llu ticks, %.3f us/tick, %.2f traces/tick, %.0f traces/s, reproduced: %s\n",
+           (unsigned long long)ticks, secs * 1e6 / ticks, (double)traces / ticks, traces / secs, same ? "yes" : "no");
+    return same ? 0 : 1;
 }
 
-static void mv_friction(vec3 vel, float dt, float stopspeed, float friction, float surfaceFriction) {
-    float spd = glm_vec3_norm(vel);
-    if (spd < 0.1)
-        return;
-    float ctrl = GLM_MAX(stopspeed, spd);
-    float drop = dt * ctrl * friction * surfaceFriction;
-    glm_vec3_scale(vel, GLM_MAX(0.0, spd - drop) / spd, vel);
+// what the render thread needs; it owns the GL context, the maps and the
+// profiler while it runs
+typedef struct {
+    GLFWwindow *window;
+    userdata_t *ud;
+    sim_t *sim;
+    renderer_t *rnd;
+    mat4 proj;
+    const char **mapPaths;
+    int nMaps;
+    bool recording; // no map changes
+    float gridCell; // of the hull grids, 0: none
+    prof_t prof;
+    stats_t latency; // input to the gpu done with the frame, ms
+    atomic_bool quit;
+    // set by the render thread, shown by the input thread
+    pthread_mutex_t titleLock;
+    char title[256];
+    bool titleNew;
+} app_t;
+
+// a latency sample ends once the gpu is done with the frame: a
+// GL_TIMESTAMP query after the swap, read a few frames later and put on
+// the simTime clock with the offset of the two clocks when it was queued
+#define LATENCY_QUERIES 4
+
+typedef struct {
+    bool gpuTimer;
+    GLuint queries[LATENCY_QUERIES];
+    bool busy[LATENCY_QUERIES];
+    double input[LATENCY_QUERIES];  // simTime of the input
+    double offset[LATENCY_QUERIES]; // simTime minus gpu time, seconds
+} latency_t;
+
+static void latencyInit(latency_t *l, bool gpuTimer) {
+    memset(l, 0, sizeof(*l));
+    l->gpuTimer = gpuTimer;
+    if (gpuTimer)
+        glGenQueries(LATENCY_QUERIES, l->queries);
 }
 
-static void mv_accelerate(vec3 vel, float dt, vec3 wishdir, float wishspd, float accel, float surfaceFriction) {
-    float speed = glm_vec3_dot(vel, wishdir);
-    float acc_1 = GLM_MAX(0.0, wishspd - speed);
-    float acc_2 = dt * wishspd * accel * surfaceFriction;
-    glm_vec3_muladds(wishdir, GLM_MIN(acc_1, acc_2), vel);
+static void latencyFree(latency_t *l) {
+    if (l->gpuTimer)
+        glDeleteQueries(LATENCY_QUERIES, l->queries);
 }
 
-static void mv_airaccelerate(vec3 vel, float dt, vec3 wishdir, float wishspd, float aircap, float accel, float surfaceFriction) {
-    wishspd = glm_clamp(wishspd, 0, aircap);
-    float speed = glm_vec3_dot(vel, wishdir);
-    float acc_1 = GLM_MAX(0.0, wishspd - speed);
-    float acc_2 = dt * wishspd * accel * surfaceFriction;
-    glm_vec3_muladds(wishdir, GLM_MIN(acc_1, acc_2), vel);
+// right after the swap; without timer queries the sample ends here, and
+// it is dropped rather than wait for a query while all are busy
+static void latencyMark(latency_t *l, double input, stats_t *out) {
+    if (!l->gpuTimer) {
+        statsAdd(out, (simTime() - input) * 1e3);
+        return;
+    }
+    for (int q = 0; q < LATENCY_QUERIES; q++) {
+        if (l->busy[q])
+            continue;
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        l->offset[q] = simTime() - gpuNow * 1e-9;
+        glQueryCounter(l->queries[q], GL_TIMESTAMP);
+        l->busy[q] = true;
+        l->input[q] = input;
+        return;
+    }
 }
 
-static void calc_wishvel(userdata_t *ud, vec3 wishdir, bool d3, float *wishspd,
-                         float forwardspeed, float sidespeed, float duckmod, float maxspeed) {
-    vec3 f, s;
-    angle_vectors(ud->ang, f, s, NULL);
-    if (!d3) {
-        f[2] = 0.0;
-        s[2] = 0.0;
+static void latencyCollect(latency_t *l, stats_t *out) {
+    for (int q = 0; q < LATENCY_QUERIES; q++) {
+        if (!l->busy[q])
+            continue;
+        GLint ready = 0;
+        glGetQueryObjectiv(l->queries[q], GL_QUERY_RESULT_AVAILABLE, &ready);
+        if (!ready)
+            continue;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(l->queries[q], GL_QUERY_RESULT, &ns);
+        l->busy[q] = false;
+        statsAdd(out, (ns * 1e-9 + l->offset[q] - l->input[q]) * 1e3);
     }
-    glm_vec3_normalize(f);
-    glm_vec3_normalize(s);
-    glm_vec3_zero(wishdir);
-    if (ud->w)
-        glm_vec3_muladds(f, +forwardspeed, wishdir);
-    if (ud->s)
-        glm_vec3_muladds(f, -forwardspeed, wishdir);
-    if (ud->a)
-        glm_vec3_muladds(s, -sidespeed, wishdir);
-    if (ud->d)
-        glm_vec3_muladds(s, +sidespeed, wishdir);
-    *wishspd = glm_vec3_norm(wishdir);
-    glm_vec3_normalize(wishdir);
-    *wishspd = glm_clamp(*wishspd, 0, maxspeed);
-    if (ud->bDucked)
-        *wishspd *= duckmod;
 }
 
-const float sv_gravity = 800.0;
-const float sv_maxspeed = 250.0;
-const float cl_sidespeed = 450.0;
-const float cl_forwardspeed = 450.0;
-const float sv_stopspeed = 100.0;
-const float sv_friction = 4.0;
-const float sv_accelerate = 5.0;
-const float sv_airaccelerate = 100.0;
-const float sv_jump_impulse = 301.993377;
-const float duck_time = 0.125;
-
-static void player_move(userdata_t *ud, float dt) {
-    vec3 wishdir;
-    float wishspd;
-    calc_wishvel(ud, wishdir, ud->bNoclip, &wishspd, cl_forwardspeed, cl_sidespeed, 0.34, sv_maxspeed);
-
-    if (ud->bNoclip) {
-        glm_vec3_scale(wishdir, wishspd, ud->vel);
-    } else {
-        if (ud->bGround) {
-            mv_friction(ud->vel, dt, sv_stopspeed, sv_friction, 1.0);
-            mv_accelerate(ud->vel, dt, wishdir, wishspd, sv_accelerate, 1.0);
-        } else {
-            mv_airaccelerate(ud->vel, dt, wishdir, wishspd, 30.0, sv_airaccelerate, 1.0);
-            ud->vel[2] -= sv_gravity * dt / 2;
+static void *renderThread(void *arg) {
+    app_t *app = arg;
+    userdata_t *ud = app->ud;
+    sim_t *sim = app->sim;
+    glfwMakeContextCurrent(app->window);
+    glfwSwapInterval(0);
+
+    map_t *cur = NULL;    // drawn
+    map_t *next = NULL;   // streaming to the gpu
+    map_t *handed = NULL; // streamed, drawn once the simulation moved in
+    int mapIndex = 0;
+    mapload_t ml;
+    memset(&ml, 0, sizeof(ml));
+    atomic_init(&ml.state, LOAD_IDLE);
+    ml.gridCell = app->gridCell;
+    stream_t stream;
+    streamInit(&stream, 4 << 20);
+    mapLoadStart(&ml, app->mapPaths[mapIndex]);
+    size_t streamFrom = 0;     // stream.sent when the next map was queued
+    uint32_t streamFrames = 0; // frames it has been streaming
+
+    mat4 m_view, m_mvp;
+    vec3 v_eye, v_lookat, v_ang;
+    double prevTitle = simTime();
+    uint64_t titleFrames = 0;
+    double shownInput = 0.0; // input time of the last latency sample
+    prof_t *prof = &app->prof;
+    latency_t lat;
+    latencyInit(&lat, prof->gpuTimer);
+
+    while (!atomic_load_explicit(&app->quit, memory_order_relaxed)) {
+        profFrame(prof);
+        latencyCollect(&lat, &app->latency);
+        double currTime = simTime();
+        snapshot_t snap;
+        snapshotRead(&sim->snaps, &snap);
+        atomic_store_explicit(&sim->ackTick, snap.tick, memory_order_release);
+
+        // setting the title costs time of its own, so only once a second
+        if (currTime - prevTitle >= 1.0) {
+            profsummary_t ps;
+            profSummary(prof, &ps);
+            const drawlist_t none = {0}, *tdl = cur ? &cur->dl : &none;
+            pthread_mutex_lock(&app->titleLock);
+            snprintf(app->title, sizeof(app->title), "GL Game (%d fps, p50 %.2f p99 %.2f gpu %.2f ms, ground %d, hull %d, duckamt %f, faces %u/%u/%u, nodes %u/%u, models %u)\n",
+                     (int)((prof->frames - titleFrames) / (currTime - prevTitle)), ps.p50, ps.p99, ps.gpuAvg,
+                     snap.pl.bGround, snap.pl.hull, snap.pl.flDuckAmount,
+                     tdl->nVis, tdl->nPVS, tdl->nDraw, tdl->nReject, tdl->nNodes, tdl->nModels);
+            app->titleNew = true;
+            pthread_mutex_unlock(&app->titleLock);
+            glfwPostEmptyEvent();
+            prevTitle = currTime;
+            titleFrames = prof->frames;
+        }
+
+        // the next map loads on a thread, streams a few MB per frame, goes
+        // to the simulation and replaces the current one once a snapshot
+        // shows the simulation has moved in
+        if (atomic_exchange_explicit(&ud->nextMap, false, memory_order_relaxed)) {
+            if (app->recording)
+                fprintf(stderr, "no map changes while recording\n");
+            else if (next || handed || !mapLoadStart(&ml, app->mapPaths[(mapIndex + 1) % app->nMaps]))
+                fprintf(stderr, "still loading\n");
+            else
+                mapIndex = (mapIndex + 1) % app->nMaps;
         }
-        {
-            bool wantJump = ud->j || ud->sd;
-            bool should_J = wantJump && !ud->bPrevJ;
-            ud->bPrevJ = wantJump;
-            ud->sd = false;
-            if (ud->bGround && should_J) {
-                fprintf(stderr, "prespeed: %.3f\n", glm_vec2_norm(ud->vel));
-                glm_vec3_copy(ud->pos, ud->jumpOff);
-                ud->vel[2] = sv_jump_impulse;
+        if (mapLoadPoll(&ml) == LOAD_DONE) {
+            next = malloc(sizeof(map_t));
+            next->bsp = ml.bsp;
+            mapCreate(next, &stream, app->rnd->mdiCaps);
+            streamFrom = stream.sent;
+            streamFrames = 0;
+        }
+        if (next) {
+            bool streamed;
+            PROF_SCOPE(prof, PROF_STREAM)
+            streamed = streamStep(&stream);
+            streamFrames++;
+            if (streamed) {
+                fprintf(stderr, "streamed %zu bytes in %u frames\n", stream.sent - streamFrom, streamFrames);
+                atomic_store_explicit(&sim->nextBsp, &next->bsp, memory_order_release);
+                handed = next;
+                next = NULL;
             }
         }
-        {
-            bool wantDuck = ud->c || ud->su;
-            ud->su = false;
-            if (wantDuck) {
-                if (ud->bGround) {
-                    ud->bInDuck = true;
-                    ud->flDuckAmount = glm_clamp(ud->flDuckAmount + dt / duck_time, 0.0, 1.0);
-                    if (ud->flDuckAmount == 1.0) {
-                        ud->bInDuck = false;
-                        if (!ud->bDucked) {
-                            ud->bDucked = true;
-                            ud->pos[2] -= 18.0;
-                            ud->hull = 2;
-                        }
-                    }
-                } else {
-                    if (!ud->bDucked) {
-                        ud->bDucked = true;
-                        ud->bInDuck = false;
-                        ud->hull = 2;
-                        ud->flDuckAmount = 1.0;
-                    }
-                }
-            } else {
-                if (ud->bGround) {
-                    // can unduck
-                    if (PM_HullPointContents(ud->bsp, ud->bsp->hull[0], (vec3){ud->pos[0], ud->pos[1], ud->pos[2] + 18.0}) == CONTENTS_EMPTY) {
-                        ud->flDuckAmount = glm_clamp(ud->flDuckAmount - dt / duck_time, 0.0, 1.0);
-                        if (ud->bInDuck || ud->bDucked) {
-                            ud->hull = 0;
-                            ud->pos[2] += 18.0;
-                            ud->bInDuck = false;
-                            ud->bDucked = false;
-                            fprintf(stderr, "unduck ground\n");
-                        }
-                    } else {
-                        ud->flDuckAmount = glm_clamp(ud->flDuckAmount + dt / duck_time, 0.0, 1.0);
-                        ud->bInDuck = true;
-                    }
-                } else {
-                    // can unduck
-                    if (ud->flDuckAmount > 0.0 && PM_HullPointContents(ud->bsp, ud->bsp->hull[0], ud->pos) == CONTENTS_EMPTY) {
-                        ud->hull = 0;
-                        ud->bDucked = false;
-                        ud->bInDuck = false;
-                        ud->flDuckAmount = 0.0;
-                    }
-                }
+        if (handed && snap.bsp == &handed->bsp) {
+            // the simulation no longer reads the old bsp
+            if (cur) {
+                mapFree(cur);
+                free(cur);
             }
+            cur = handed;
+            handed = NULL;
         }
-    }
 
-    float frac = 0.0f;
-    float curr_pos[3];
-    float next_pos[3];
-    glm_vec3_copy(ud->pos, curr_pos);
-    for (int i = 0; i < 4; i++) {
-        // next_pos if not clipped
-        glm_vec3_copy(curr_pos, next_pos);
-        glm_vec3_muladds(ud->vel, (1.0f - frac) * dt, next_pos);
-        // trace curr_pos -> next_pos
-        pmtrace_t trace;
-        memset(&trace, 0, sizeof(trace));
-        if (ud->bNoclip || PM_RecursiveHullCheck(ud->bsp, ud->bsp->hull[ud->hull], ud->bsp->hull[ud->hull], frac, 1.0f, curr_pos, next_pos, &trace)) { // full move
-            if (trace.startsolid && !ud->bNoclip)
-                break;
-            frac = 1.0;
-            glm_vec3_copy(next_pos, ud->pos);
-            break;
-        }
-        // clip vel
-        float backoff = glm_vec3_dot(trace.plane.n, ud->vel);
-        if (backoff < 0) {
-            // fprintf(stderr, "normal:\n");
-            // glm_vec3_print(trace.plane.n, stderr);
-            // fprintf(stderr, "speed:\n");
-            // glm_vec3_print(ud->vel, stderr);
-            // fprintf(stderr, "dist: %f\n", glm_vec3_dot(ud->pos, trace.plane.n) - trace.plane.d);
-            glm_vec3_muladds(trace.plane.n, -backoff, ud->vel);
+        if (cur) {
+            cur->dl.frustum = atomic_load_explicit(&ud->frustum, memory_order_relaxed);
+            bool models = atomic_load_explicit(&ud->models, memory_order_relaxed);
+            if (cur->dl.models != models) {
+                cur->dl.models = models;
+                cur->dl.leaf = -1; // rebuild
+            }
         }
-        // use endpos as next_pos
-        frac = trace.fraction;
-        glm_vec3_copy(trace.endpos, next_pos);
-        glm_vec3_copy(trace.endpos, ud->pos);
-    }
+        app->rnd->prepass = atomic_load_explicit(&ud->prepass, memory_order_relaxed);
+
+        // the view is between the last two ticks
+        float frac = (currTime - snap.time) * sim->tickrate;
+        glm_vec3_lerp(snap.prevEye, snap.eye, glm_clamp(frac, 0.0f, 1.0f), v_eye);
+        viewLoad(ud, v_ang);
+        angle_vectors(v_ang, v_lookat, NULL, NULL);
+        glm_vec3_add(v_eye, v_lookat, v_lookat);
+        glm_lookat(v_eye, v_lookat, GLM_ZUP, m_view);
+        glm_mat4_mul(app->proj, m_view, m_mvp);
 
-    // if (frac < 1.0) {
-    //     fprintf(stderr, "frac: %.3f\n", frac);
-    //     glm_vec3_print(ud->vel, stderr);
-    // }
-
-    ud->bGround = false;
-    if (!ud->bNoclip) {
-        pmtrace_t trace;
-        glm_vec3_add(ud->pos, (vec3){0.0, 0.0, -2.0}, next_pos);
-        if (!PM_RecursiveHullCheck(ud->bsp, ud->bsp->hull[ud->hull], ud->bsp->hull[ud->hull], 0.0, 1.0, ud->pos, next_pos, &trace)) {
-            if (trace.plane.n[2] > 0.7 && ud->vel[2] < 180.0)
-                ud->bGround = true;
+        profGpuBegin(prof);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (cur)
+            mapDraw(app->rnd, cur, m_mvp, v_eye, prof);
+        profGpuEnd(prof);
+        PROF_SCOPE(prof, PROF_SWAP)
+        glfwSwapBuffers(app->window);
+        // from the oldest input in this frame until the gpu has done it
+        if (snap.inputTime != 0.0 && snap.inputTime != shownInput) {
+            latencyMark(&lat, snap.inputTime, &app->latency);
+            shownInput = snap.inputTime;
         }
-        if (!ud->bGround)
-            ud->vel[2] -= sv_gravity * dt / 2;
     }
+    profFrame(prof);
+    latencyFree(&lat);
+
+    mapLoadCancel(&ml);
+    map_t *maps[] = {cur, next, handed};
+    for (int i = 0; i < 3; i++)
+        if (maps[i]) {
+            mapFree(maps[i]);
+            free(maps[i]);
+        }
+    streamFree(&stream);
+    glfwMakeContextCurrent(NULL);
+    return NULL;
+}
+
+static void printStats(const char *what, const stats_t *s) {
+    statsummary_t ss;
+    statsSummary(s, &ss);
+    fprintf(stderr, "%s: %llu, ms avg %.3f p50 %.3f p99 %.3f max %.3f\n",
+            what, (unsigned long long)ss.count, ss.avg, ss.p50, ss.p99, ss.max);
 }
 
 int main(int argc, char **argv) {
+    const char *recordFile = NULL, *replayFile = NULL, *profFile = NULL;
+    int tickrate = 100;
+    int repeat = 1;
+    int agents = 0, ticks = 1000, threads = 0;      // server mode
+    int benchCount = 0, gridCount = 0, rayCount = 0; // queries per benchmark
+    float gridCell = 32.0f; // hull grids of the loaded maps, 0: none
+    const char **mapPaths = malloc(sizeof(char *) * argc); // N goes through them
+    int nMaps = 0;
+    mapPaths[nMaps++] = argv[1];
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--no-compact") == 0)
+            zigLoadOptions.compact = 0;
+        else if (strcmp(argv[i], "--reorder") == 0)
+            zigLoadOptions.reorder = 1;
+        else if (strcmp(argv[i], "--no-relayout") == 0)
+            zigLoadOptions.relayout = 0;
+        else if (strcmp(argv[i], "--load-threads") == 0 && i + 1 < argc) {
+            if (!parseLoadThreads(argv[++i]))
+                return 1;
+        } else if (strcmp(argv[i], "--paletted") == 0)
+            zigLoadOptions.paletted = 1;
+        else if (strcmp(argv[i], "--bench-hull") == 0 && i + 1 < argc)
+            benchCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bench-grid") == 0 && i + 1 < argc)
+            gridCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bench-ray") == 0 && i + 1 < argc)
+            rayCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--grid-cell") == 0 && i + 1 < argc)
+            gridCell = atof(argv[++i]);
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            recordFile = argv[++i];
+        else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc)
+            mapPaths[nMaps++] = argv[++i];
+        else if (strcmp(argv[i], "--prof") == 0 && i + 1 < argc)
+            profFile = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replayFile = argv[++i];
+        else if (strcmp(argv[i], "--tickrate") == 0 && i + 1 < argc)
+            tickrate = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc)
+            agents = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc)
+            ticks = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+    }
+
+    if (replayFile || agents > 0 || benchCount > 0 || gridCount > 0 || rayCount > 0) {
+        ZigLoadBSP bsp;
+        if (zigLoadBSPCached(argv[1], &bsp) != 0)
+            return 1;
+        int ret = 0;
+        if (benchCount > 0)
+            ret = !benchHull(&bsp, benchCount, 1);
+        else if (gridCount > 0)
+            ret = !benchGrid(&bsp, gridCount, threads, 1);
+        else if (rayCount > 0)
+            ret = !benchRay(&bsp, rayCount, threads, 1);
+        else {
+            if (gridCell > 0.0f) {
+                pool_t *pool = poolCreate(threads);
+                if (!PM_GridAttach(pool, &bsp, gridCell))
+                    fprintf(stderr, "hull grids: out of memory, walking the trees\n");
+                poolDestroy(pool);
+            }
+            if (replayFile)
+                ret = replayDemo(&bsp, replayFile, repeat);
+            else
+                ret = serverRun(&bsp, agents, ticks, threads, tickrate > 0 ? tickrate : 100);
+        }
+        PM_GridDetach(&bsp);
+        zigFreeBSP(&bsp);
+        return ret;
+    }
+
+    if (tickrate <= 0)
+        tickrate = 100; // the simulation thread runs fixed ticks
+    demo_t demo;
+    if (recordFile) {
+        if (!demoRecord(&demo, recordFile, tickrate)) {
+            fprintf(stderr, "can not record demo %s\n", recordFile);
+            recordFile = NULL;
+        }
+    }
+
     glfwSetErrorCallback(cbGlfwError);
     glfwInit();
     glfwWindowHint(GLFW_RESIZABLE, false);
@@ -584,8 +566,29 @@ int main(int argc, char **argv) {
 
     // fprintf(stderr, "GLEW_ARB_bindless_texture = %d\n", GLEW_ARB_bindless_texture);
 
+    renderer_t rnd;
+    if (!rendererInit(&rnd)) {
+        glfwTerminate();
+        return 1;
+    }
+
+    sim_t *sim = malloc(sizeof(sim_t)); // large, the input queue is in it
+    if (!simStart(sim, tickrate, recordFile ? &demo : NULL)) {
+        fprintf(stderr, "can not start the simulation thread\n");
+        free(sim);
+        rendererFree(&rnd);
+        glfwTerminate();
+        return 1;
+    }
+
     userdata_t ud;
     memset(&ud, 0, sizeof(ud));
+    ud.sim = sim;
+    atomic_init(&ud.frustum, true);
+    atomic_init(&ud.models, true);
+    atomic_init(&ud.prepass, false);
+    atomic_init(&ud.nextMap, false);
+    viewStore(&ud);
     glfwSetWindowUserPointer(window, &ud);
     glfwSetKeyCallback(window, cbGLFWKey);
     glfwSetScrollCallback(window, cbGLFWScr);
@@ -593,131 +596,71 @@ int main(int argc, char **argv) {
     glfwSetMouseButtonCallback(window, cbGLFWBtn);
     glfwSetWindowFocusCallback(window, cbGLFWFocus);
 
-    GLuint sh = glCreateProgram();
-    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
-    char *vss = readFile("v.glsl");
-    char *fss = readFile("f.glsl");
-    glShaderSource(vs, 1, (const GLchar *const *)&vss, NULL);
-    glShaderSource(fs, 1, (const GLchar *const *)&fss, NULL);
-    free(vss);
-    free(fss);
-    glCompileShader(vs);
-    glCompileShader(fs);
-    glAttachShader(sh, vs);
-    glAttachShader(sh, fs);
-    glLinkProgram(sh);
-    glDetachShader(sh, vs);
-    glDetachShader(sh, fs);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
-    glUseProgram(sh);
-    GLuint vao, vbo, ebo;
-    glCreateVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-
-    ZigLoadBSP bsp;
-    bool bspload = false;
-    GLuint *texObjs = NULL;
-    if (zigLoadBSP(argv[1], &bsp) == 0) {
-        glBufferData(GL_ARRAY_BUFFER, bsp.vbo_size, bsp.vbo_data, GL_STATIC_DRAW);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, bsp.ebo_size, bsp.ebo_data, GL_STATIC_DRAW);
-        texObjs = malloc(sizeof(GLuint) * bsp.text_cnt);
-        glGenTextures(bsp.text_cnt, texObjs);
-        for (uint32_t i = 0; i < bsp.text_cnt; i++) {
-            ZigBSPTex bsptex = bsp.textures[i];
-            glBindTexture(GL_TEXTURE_2D, texObjs[i]);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, bsptex.width, bsptex.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, bsptex.pixels);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-            glGenerateMipmap(GL_TEXTURE_2D);
-        }
-        fprintf(stderr, "loaded: vertices: %zu indices: %zu textures: %zu\n", bsp.vbo_size / sizeof(float[3]), bsp.ebo_size / sizeof(uint32_t), bsp.text_cnt);
-        fprintf(stderr, "clipnodes: %zu, planes: %zu\n", bsp.clip_cnt, bsp.planecnt);
-        bspload = true;
-        ud.bsp = &bsp;
-    }
-
-    GLuint locVtxPos = glGetAttribLocation(sh, "vtxPos");
-    GLuint locTexPos = glGetAttribLocation(sh, "texPos");
-    glEnableVertexAttribArray(locVtxPos);
-    glEnableVertexAttribArray(locTexPos);
-    glVertexAttribPointer(locVtxPos, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(0 * sizeof(float)));
-    glVertexAttribPointer(locTexPos, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)(3 * sizeof(float)));
-    GLuint locMVP = glGetUniformLocation(sh, "mvp");
-    GLuint locTex = glGetUniformLocation(sh, "tex");
-    glUniform1i(locTex, 0); // GL_TEXTURE0
-
-    glfwSwapInterval(0);
-    glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-    // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-
-    mat4 m_proj, m_view, m_mvp;
-
+    app_t app;
+    memset(&app, 0, sizeof(app));
+    app.window = window;
+    app.ud = &ud;
+    app.sim = sim;
+    app.rnd = &rnd;
+    app.mapPaths = mapPaths;
+    app.nMaps = nMaps;
+    app.recording = recordFile != NULL;
+    app.gridCell = gridCell;
+    atomic_init(&app.quit, false);
+    pthread_mutex_init(&app.titleLock, NULL);
     int w, h;
     glfwGetWindowSize(window, &w, &h);
-    glm_perspective(glm_rad(60.0), (float)w / (float)h, 8.0, 16384.0, m_proj);
-    vec3 v_eye, v_lookat;
-    double prevTime = glfwGetTime();
-    double prevFpsX = glfwGetTime();
-    int fps = 0;
-
-    glActiveTexture(GL_TEXTURE0);
+    glm_perspective(glm_rad(60.0), (float)w / (float)h, 8.0, 16384.0, app.proj);
+    profInit(&app.prof, 4096);
+    statsInit(&app.latency, 4096);
 
     fprintf(stderr, "HELLO: " __FILE__ " %d\n", __LINE__);
 
-    while (glfwWindowShouldClose(window) == 0) {
-        double currTime = glfwGetTime();
-        double dt = currTime - prevTime;
-        prevTime = currTime;
-        fps++;
-        if (currTime - prevFpsX >= 0.01) {
-            char title[64];
-            snprintf(title, sizeof(title), "GL Game (%d fps, ground %d, hull %d, duckamt %f)\n", (int)(fps / (currTime - prevFpsX)), ud.bGround, ud.hull, ud.flDuckAmount);
-            glfwSetWindowTitle(window, title);
-            prevFpsX = currTime;
-            fps = 0;
-        }
-        glfwPollEvents();
-
-        player_move(&ud, dt);
-
-        v_eye[0] = ud.pos[0];
-        v_eye[1] = ud.pos[1];
-        v_eye[2] = ud.pos[2] - (ud.hull == 0 ? 36.0 : 18.0) + 36.0 * (1.0 - ud.flDuckAmount) + 28.0;
-
-        angle_vectors(ud.ang, v_lookat, NULL, NULL);
-        glm_vec3_add(v_eye, v_lookat, v_lookat);
-        glm_lookat(v_eye, v_lookat, GLM_ZUP, m_view);
-        glm_mat4_mul(m_proj, m_view, m_mvp);
-        glUniformMatrix4fv(locMVP, 1, GL_FALSE, &m_mvp[0][0]);
-
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        for (uint32_t i = 0; i < bsp.text_cnt; i++) {
-            ZigBSPTex bsptex = bsp.textures[i];
-            if (bsptex.n3Indexs > 0 && !bsptex.skipped) {
-                glBindTexture(GL_TEXTURE_2D, texObjs[i]);
-                glDrawElements(GL_TRIANGLES, bsptex.n3Indexs * 3, GL_UNSIGNED_INT, (void *)(sizeof(uint32_t[3]) * bsptex.i3Index0));
-            }
+    // this thread only waits for events, the callbacks hand them on
+    glfwMakeContextCurrent(NULL);
+    pthread_t renderer;
+    if (pthread_create(&renderer, NULL, renderThread, &app) != 0) {
+        fprintf(stderr, "can not start the render thread\n");
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+    } else {
+        while (glfwWindowShouldClose(window) == 0) {
+            glfwWaitEvents();
+            pthread_mutex_lock(&app.titleLock);
+            if (app.titleNew)
+                glfwSetWindowTitle(window, app.title);
+            app.titleNew = false;
+            pthread_mutex_unlock(&app.titleLock);
         }
-        glfwSwapBuffers(window);
+        // the simulation first, the maps it moves in go with the render thread
+        simStop(sim);
+        atomic_store_explicit(&app.quit, true, memory_order_relaxed);
+        pthread_join(renderer, NULL);
     }
+    simStop(sim);
+    glfwMakeContextCurrent(window);
 
-    if (bspload) {
-        free(texObjs);
-        zigFreeBSP(&bsp);
+    profsummary_t ps;
+    profSummary(&app.prof, &ps);
+    fprintf(stderr, "frames: %u, ms avg %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f, gpu avg %.3f\n",
+            ps.frames, ps.avg, ps.p50, ps.p90, ps.p99, ps.max, ps.gpuAvg);
+    printStats("input to frame done", &app.latency);
+    printStats("tick start late", &sim->late);
+    if (sim->input.dropped)
+        fprintf(stderr, "input events dropped: %u\n", sim->input.dropped);
+    if (profFile && !profDump(&app.prof, profFile))
+        fprintf(stderr, "can not write %s\n", profFile);
+    profFree(&app.prof);
+    statsFree(&app.latency);
+    pthread_mutex_destroy(&app.titleLock);
+    if (recordFile) {
+        demoClose(&demo, sim->pl.pos, sim->pl.vel);
+        fprintf(stderr, "recorded %u ticks to %s\n", demo.ticks, recordFile);
     }
+    simFree(sim);
+    free(sim);
+    rendererFree(&rnd);
+    free(mapPaths);
 
     glfwTerminate();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,182 @@
+//! Preprocessed map cache: the final ZigLoadBSP payload in one file,
+//! which is mapped and pointer-fixed instead of loading the bsp again.
+const std = @import("std");
+const ld = @import("loadbsp.zig");
+const ZigLoadBSP = ld.ZigLoadBSP;
+
+/// bump when ZigLoadBSP or anything it points to changes
+pub const version = 9;
+
+const section_align = 64;
+
+/// ZigLoadBSP arrays, as pointer field and element count field
+const sections = .{
+    .{ "vbo_data", "vbo_size" },
+    .{ "ebo_data", "ebo_size" },
+    .{ "textures", "text_cnt" },
+    .{ "clipnode", "clip_cnt" },
+    .{ "b_planes", "planecnt" },
+    .{ "nodes", "nodecnt" },
+    .{ "leaves", "leafcnt" },
+    .{ "marksurf", "markcnt" },
+    .{ "visdata", "vis_size" },
+    .{ "facedraw", "face_cnt" },
+    .{ "texarrs", "tarr_cnt" },
+    .{ "models", "model_cnt" },
+    .{ "ranges", "range_cnt" },
+    .{ "hullnode", "hnode_cnt" },
+    .{ "palettes", "pal_cnt" },
+    .{ "lightmap", "lm_size" },
+};
+
+/// in the file, every section pointer of result is an offset into the file,
+/// and so are ZigBSPTex.pixels and ZigBSPTex.indexs
+const Header = extern struct {
+    magic: [4]u8,
+    version: u32,
+    ptrsize: u32,
+    /// ZigLoadOptions the result was loaded with
+    options: u32,
+    hash: u64,
+    bspsize: u64,
+    result: ZigLoadBSP,
+};
+
+const magic = "HLBC".*;
+
+fn Elem(comptime field: []const u8) type {
+    return @typeInfo(@TypeOf(@field(@as(ZigLoadBSP, undefined), field))).Pointer.child;
+}
+
+fn sectionBytes(r: *const ZigLoadBSP, comptime sec: anytype) []const u8 {
+    const T = Elem(sec[0]);
+    const many: [*]const u8 = @ptrCast(@field(r, sec[0]));
+    return many[0 .. @field(r, sec[1]) * @sizeOf(T)];
+}
+
+fn options() u32 {
+    const o = ld.zigLoadOptions;
+    return @as(u32, o.compact) | @as(u32, o.reorder) << 8 | @as(u32, o.relayout) << 16 | @as(u32, o.paletted) << 24;
+}
+
+/// hash of the whole bsp file
+pub fn hashFile(file: std.fs.File) !struct { hash: u64, size: u64 } {
+    const size: usize = @intCast(try file.getEndPos());
+    if (size == 0) return .{ .hash = 0, .size = 0 };
+    const bytes = try std.os.mmap(null, size, std.os.PROT.READ, std.os.MAP.PRIVATE, file.handle, 0);
+    defer std.os.munmap(bytes);
+    return .{ .hash = std.hash.Wyhash.hash(0, bytes), .size = size };
+}
+
+/// map a cache file, error.CacheMiss if it is missing, stale or broken
+pub fn load(path: [*:0]const u8, hash: u64, bspsize: u64) !ZigLoadBSP {
+    const file = std.fs.cwd().openFileZ(path, .{}) catch return error.CacheMiss;
+    defer file.close();
+    const size: usize = @intCast(try file.getEndPos());
+    if (size < @sizeOf(Header)) return error.CacheMiss;
+    // private writable mapping, only pages with pointers to fix get copied
+    const map = try std.os.mmap(null, size, std.os.PROT.READ | std.os.PROT.WRITE, std.os.MAP.PRIVATE, file.handle, 0);
+    errdefer std.os.munmap(map);
+
+    const header: *const Header = @ptrCast(map.ptr);
+    if (!std.mem.eql(u8, &header.magic, &magic) or header.version != version or
+        header.ptrsize != @sizeOf(usize) or header.options != options() or
+        header.hash != hash or header.bspsize != bspsize)
+        return error.CacheMiss;
+
+    var result = header.result;
+    inline for (sections) |sec| {
+        const offset = @intFromPtr(@field(result, sec[0]));
+        const length = @field(result, sec[1]) * @sizeOf(Elem(sec[0]));
+        if (offset > size or length > size - offset) return error.CacheMiss;
+        @field(result, sec[0]) = @ptrCast(@alignCast(map.ptr + offset));
+    }
+    for (result.textures[0..result.text_cnt]) |*t| {
+        if (t.pixels) |p| {
+            const offset = @intFromPtr(p);
+            const length = ld.mipPixelCount(t.width, t.height) * 4;
+            if (offset > size or length > size - offset) return error.CacheMiss;
+            t.pixels = @ptrCast(map.ptr + offset);
+        }
+        if (t.indexs) |p| {
+            const offset = @intFromPtr(p);
+            const length = ld.mipPixelCount(t.width, t.height);
+            if (offset > size or length > size - offset) return error.CacheMiss;
+            t.indexs = map.ptr + offset;
+        }
+    }
+    result.mapping = map.ptr;
+    result.map_size = map.len;
+    result.cached = 1;
+    result.grids = null;
+    return result;
+}
+
+/// write result to path, through a temporary file so readers never see half of it
+pub fn store(path: [*:0]const u8, hash: u64, bspsize: u64, result: *const ZigLoadBSP) !void {
+    var header = Header{
+        .magic = magic,
+        .version = version,
+        .ptrsize = @sizeOf(usize),
+        .options = options(),
+        .hash = hash,
+        .bspsize = bspsize,
+        .result = result.*,
+    };
+    header.result.mapping = null;
+    header.result.map_size = 0;
+    header.result.cached = 0;
+    header.result.grids = null;
+
+    // layout: header, sections, then all texture pixels or indices
+    var offset: usize = std.mem.alignForward(usize, @sizeOf(Header), section_align);
+    inline for (sections) |sec| {
+        @field(header.result, sec[0]) = @ptrFromInt(offset);
+        offset = std.mem.alignForward(usize, offset + sectionBytes(result, sec).len, section_align);
+    }
+    const textures = result.textures[0..result.text_cnt];
+    const cachetexs = try std.heap.c_allocator.alloc(ld.ZigBSPTex, textures.len);
+    defer std.heap.c_allocator.free(cachetexs);
+    for (cachetexs, textures) |*c, t| {
+        c.* = t;
+        if (t.pixels != null) {
+            c.pixels = @ptrFromInt(offset);
+            offset += ld.mipPixelCount(t.width, t.height) * 4;
+        }
+        if (t.indexs != null) {
+            c.indexs = @ptrFromInt(offset);
+            offset += ld.mipPixelCount(t.width, t.height);
+        }
+    }
+
+    var tmpbuf: [std.fs.MAX_PATH_BYTES]u8 = undefined;
+    const tmppath = try std.fmt.bufPrintZ(&tmpbuf, "{s}.tmp", .{std.mem.span(path)});
+    const file = try std.fs.cwd().createFileZ(tmppath, .{});
+    errdefer std.fs.cwd().deleteFileZ(tmppath) catch {};
+    {
+        defer file.close();
+        var buffered = std.io.bufferedWriter(file.writer());
+        var counting = std.io.countingWriter(buffered.writer());
+        const w = counting.writer();
+        try w.writeAll(std.mem.asBytes(&header));
+        inline for (sections) |sec| {
+            try w.writeByteNTimes(0, @intFromPtr(@field(header.result, sec[0])) - @as(usize, @intCast(counting.bytes_written)));
+            if (comptime std.mem.eql(u8, sec[0], "textures"))
+                try w.writeAll(std.mem.sliceAsBytes(cachetexs))
+            else
+                try w.writeAll(sectionBytes(result, sec));
+        }
+        for (cachetexs, textures) |c, t| {
+            if (t.pixels) |p| {
+                try w.writeByteNTimes(0, @intFromPtr(c.pixels.?) - @as(usize, @intCast(counting.bytes_written)));
+                try w.writeAll(std.mem.sliceAsBytes(p[0..ld.mipPixelCount(t.width, t.height)]));
+            }
+            if (t.indexs) |p| {
+                try w.writeByteNTimes(0, @intFromPtr(c.indexs.?) - @as(usize, @intCast(counting.bytes_written)));
+                try w.writeAll(p[0..ld.mipPixelCount(t.width, t.height)]);
+            }
+        }
+        try buffered.flush();
+    }
+    try std.fs.cwd().renameZ(tmppath, path);
+}
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mapload.h"
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *loadThread(void *arg) {
+    mapload_t *ml = arg;
+    int ret = zigLoadBSPCached(ml->path, &ml->bsp);
+    if (ret == 0 && ml->gridCell > 0.0f) {
+        pool_t *pool = poolCreate(zigLoadOptions.threads);
+        if (!PM_GridAttach(pool, &ml->bsp, ml->gridCell))
+            fprintf(stderr, "%s: hull grids out of memory, walking the trees\n", ml->path);
+        poolDestroy(pool);
+    }
+    atomic_store_explicit(&ml->state, ret == 0 ? LOAD_DONE : LOAD_FAILED, memory_order_release);
+    return NULL;
+}
+
+bool parseLoadThreads(const char *arg) {
+    char *end;
+    long n = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || n < 0 || n > 255) {
+        fprintf(stderr, "--load-threads: %s is not 0 (one per core) to 255\n", arg);
+        return false;
+    }
+    zigLoadOptions.threads = (uint8_t)n;
+    return true;
+}
+
+bool mapLoadStart(mapload_t *ml, const char *path) {
+    if (atomic_load_explicit(&ml->state, memory_order_acquire) != LOAD_IDLE)
+        return false;
+    ml->path = path;
+    ml->start = now();
+    atomic_store_explicit(&ml->state, LOAD_BUSY, memory_order_relaxed);
+    if (pthread_create(&ml->thread, NULL, loadThread, ml) != 0) {
+        atomic_store_explicit(&ml->state, LOAD_IDLE, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+loadstate_t mapLoadPoll(mapload_t *ml) {
+    loadstate_t state = atomic_load_explicit(&ml->state, memory_order_acquire);
+    if (state == LOAD_DONE || state == LOAD_FAILED) {
+        pthread_join(ml->thread, NULL);
+        fprintf(stderr, "%s %s in the background in %.1f ms\n", ml->path,
+                state == LOAD_DONE ? "loaded" : "failed", (now() - ml->start) * 1e3);
+        atomic_store_explicit(&ml->state, LOAD_IDLE, memory_order_relaxed);
+    }
+    return state;
+}
+
+enum { JOB_BUFFER, JOB_TEX2D, JOB_LAYER };
+
+struct streamjob {
+    int kind;
+    GLuint obj;
+    const uint8_t *data;
+    size_t size;
+    size_t done;   // bytes sent, a buffer goes in pieces
+    size_t offset; // in the pbo, this frame
+    GLint level, layer;
+    GLsizei width, height;
+    GLenum format; // GL_RGBA, GL_RGB or GL_RED
+};
+
+void streamInit(stream_t *st, size_t budget) {
+    memset(st, 0, sizeof(*st));
+    st->budget = budget;
+    glGenBuffers(1, &st->pbo);
+}
+
+void streamFree(stream_t *st) {
+    glDeleteBuffers(1, &st->pbo);
+    free(st->jobs);
+    free(st->ops);
+}
+
+static void push(stream_t *st, streamjob_t job) {
+    if (st->next == st->nJobs) {
+        // all done, start over
+        st->nJobs = 0;
+        st->next = 0;
+    }
+    if (st->nJobs == st->capJobs) {
+        st->capJobs = st->capJobs ? st->capJobs * 2 : 256;
+        st->jobs = realloc(st->jobs, sizeof(streamjob_t) * st->capJobs);
+        st->ops = realloc(st->ops, sizeof(size_t) * st->capJobs);
+    }
+    st->jobs[st->nJobs++] = job;
+    st->bytes += job.size;
+}
+
+void streamBuffer(stream_t *st, GLuint buf, const void *data, size_t size) {
+    if (size > 0)
+        push(st, (streamjob_t){.kind = JOB_BUFFER, .obj = buf, .data = data, .size = size});
+}
+
+static size_t texelSize(GLenum format) {
+    return format == GL_RED ? 1 : format == GL_RGB ? 3 : 4;
+}
+
+void streamTex2D(stream_t *st, GLuint tex, GLint level, GLsizei width, GLsizei height, GLenum format, const void *pixels) {
+    push(st, (streamjob_t){.kind = JOB_TEX2D, .obj = tex, .data = pixels, .size = (size_t)width * height * texelSize(format),
+                           .level = level, .width = width, .height = height, .format = format});
+}
+
+void streamTexLayer(stream_t *st, GLuint tex, GLint level, GLint layer, GLsizei width, GLsizei height, GLenum format, const void *pixels) {
+    push(st, (streamjob_t){.kind = JOB_LAYER, .obj = tex, .data = pixels, .size = (size_t)width * height * texelSize(format),
+                           .level = level, .layer = layer, .width = width, .height = height, .format = format});
+}
+
+bool streamStep(stream_t *st) {
+    if (st->next == st->nJobs)
+        return true;
+    streamjob_t *first = st->jobs + st->next;
+    size_t cap = st->budget;
+    if (first->kind != JOB_BUFFER && first->size > cap)
+        cap = first->size;
+
+    // orphan, so the driver never waits for last frame's copies
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, st->pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, cap, NULL, GL_STREAM_DRAW);
+    uint8_t *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, cap, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (!dst) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return false;
+    }
+    size_t used = 0, nOps = 0;
+    while (st->next < st->nJobs) {
+        streamjob_t *job = st->jobs + st->next;
+        size_t n = job->size - job->done;
+        if (job->kind == JOB_BUFFER)
+            n = n < cap - used ? n : cap - used;
+        else if (n > cap - used)
+            break;
+        if (n == 0)
+            break;
+        // pieces start 4 byte aligned for the texture rows
+        if (job->data)
+            memcpy(dst + used, job->data + job->done, n);
+        job->offset = used;
+        st->ops[nOps++] = st->next;
+        used += (n + 3) & ~(size_t)3;
+        if (job->kind != JOB_BUFFER || job->done + n == job->size)
+            st->next++;
+        if (used >= cap)
+            break;
+    }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    // rows of the small GL_RED levels and of GL_RGB are not 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (size_t i = 0; i < nOps; i++) {
+        streamjob_t *job = st->jobs + st->ops[i];
+        const void *src = (const void *)(uintptr_t)job->offset;
+        switch (job->kind) {
+        case JOB_BUFFER: {
+            size_t n = job->size - job->done;
+            size_t room = cap - job->offset;
+            n = n < room ? n : room;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, job->obj);
+            glCopyBufferSubData(GL_PIXEL_UNPACK_BUFFER, GL_COPY_WRITE_BUFFER, job->offset, job->done, n);
+            job->done += n;
+            st->sent += n;
+            break;
+        }
+        case JOB_TEX2D:
+            glBindTexture(GL_TEXTURE_2D, job->obj);
+            glTexSubImage2D(GL_TEXTURE_2D, job->level, 0, 0, job->width, job->height, job->format, GL_UNSIGNED_BYTE, src);
+            st->sent += job->size;
+            break;
+        case JOB_LAYER:
+            glBindTexture(GL_TEXTURE_2D_ARRAY, job->obj);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, job->level, 0, 0, job->layer, job->width, job->height, 1, job->format, GL_UNSIGNED_BYTE, src);
+            st->sent += job->size;
+            break;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return st->next == st->nJobs;
+}
+
+void mapLoadCancel(mapload_t *ml) {
+    loadstate_t state = atomic_load_explicit(&ml->state, memory_order_acquire);
+    if (state == LOAD_IDLE)
+        return;
+    pthread_join(ml->thread, NULL);
+    if (atomic_load_explicit(&ml->state, memory_order_acquire) == LOAD_DONE) {
+        PM_GridDetach(&ml->bsp);
+        zigFreeBSP(&ml->bsp);
+    }
+    atomic_store_explicit(&ml->state, LOAD_IDLE, memory_order_relaxed);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <GL/glew.h>
+#include "bsp.h"
+
+// background map load: zigLoadBSPCached and the hull grids on a worker
+// thread, then the data goes to the gpu a bounded amount per frame,
+// through a pixel unpack buffer that is orphaned every frame
+
+typedef enum {
+    LOAD_IDLE,
+    LOAD_BUSY,   // worker thread is loading
+    LOAD_DONE,   // bsp is ready
+    LOAD_FAILED,
+} loadstate_t;
+
+typedef struct {
+    pthread_t thread;
+    atomic_int state; // loadstate_t, written last by the worker
+    const char *path;
+    ZigLoadBSP bsp; // with its grids, PM_GridDetach before zigFreeBSP
+    double start;
+    float gridCell; // of the hull grids, 0: none
+} mapload_t;
+
+// --load-threads K into zigLoadOptions.threads: 0 (one per core) to 255,
+// else false with a message
+bool parseLoadThreads(const char *arg);
+bool mapLoadStart(mapload_t *ml, const char *path); // false if a load is running
+// the state, joins the worker once it is done; after LOAD_DONE the bsp
+// belongs to the caller and the loader is idle again
+loadstate_t mapLoadPoll(mapload_t *ml);
+void mapLoadCancel(mapload_t *ml); // wait for the worker and drop its result
+
+typedef struct streamjob streamjob_t;
+
+typedef struct {
+    GLuint pbo;
+    size_t budget; // bytes per frame
+    streamjob_t *jobs;
+    size_t nJobs, capJobs;
+    size_t next;  // first job not done
+    size_t *ops;  // jobs of the current frame
+    size_t bytes; // queued in total
+    size_t sent;  // uploaded in total
+} stream_t;
+
+void streamInit(stream_t *st, size_t budget);
+void streamFree(stream_t *st);
+// queue uploads, data must stay valid until they are done; storage of
+// buf and tex must be allocated already, format is GL_RGBA, GL_RGB or GL_RED
+void streamBuffer(stream_t *st, GLuint buf, const void *data, size_t size);
+void streamTex2D(stream_t *st, GLuint tex, GLint level, GLsizei width, GLsizei height, GLenum format, const void *pixels);
+void streamTexLayer(stream_t *st, GLuint tex, GLint level, GLint layer, GLsizei width, GLsizei height, GLenum format, const void *pixels);
+// upload up to budget bytes, or one texture level that is larger;
+// true once the queue is empty
+bool streamStep(stream_t *st);
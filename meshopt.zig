@@ -0,0 +1,263 @@
+//! Post-transform vertex cache optimization: Tipsify (Sander, Nehab and
+//! Barczak 2007) on whole faces, so every face stays one index range for
+//! the drawlist, and the cache miss ratio to compare orders.
+const std = @import("std");
+const ld = @import("loadbsp.zig");
+const par = @import("parallel.zig");
+const alloc = std.heap.c_allocator;
+
+/// FIFO entries of the simulated post-transform cache
+pub const cache_size = 16;
+
+/// FIFO cache simulation, a vertex is in the cache if it was one of the
+/// last cache_size misses: clock - stamps[v] <= cache_size
+const Cache = struct {
+    stamps: []u32,
+    clock: u32 = cache_size + 1,
+
+    fn init(nverts: usize) !Cache {
+        const stamps = try alloc.alloc(u32, nverts);
+        @memset(stamps, 0);
+        return .{ .stamps = stamps };
+    }
+
+    fn deinit(self: *Cache) void {
+        alloc.free(self.stamps);
+    }
+
+    /// empty the cache without touching every stamp
+    fn flush(self: *Cache) void {
+        self.clock += cache_size + 1;
+    }
+
+    fn age(self: *const Cache, v: u32) u32 {
+        return self.clock - self.stamps[v];
+    }
+
+    /// returns true on a miss
+    fn touch(self: *Cache, v: u32) bool {
+        if (self.age(v) <= cache_size) return false;
+        self.stamps[v] = self.clock;
+        self.clock += 1;
+        return true;
+    }
+};
+
+fn maxIndex(tris: []const [3]u32) u32 {
+    var m: u32 = 0;
+    for (tris) |t| m = @max(m, @max(t[0], @max(t[1], t[2])));
+    return m;
+}
+
+/// average cache miss ratio, vertex shader runs per triangle, of groups
+/// drawn one after another, indices are relative to each group
+pub fn acmr(ebo: []const [3]u32, groups: anytype) !f64 {
+    if (ebo.len == 0) return 0;
+    var cache = try Cache.init(maxIndex(ebo) + 1);
+    defer cache.deinit();
+    var misses: usize = 0;
+    for (groups) |grp| {
+        cache.flush();
+        for (ebo[grp.i3Index0..][0..grp.n3Indexs]) |t| for (t) |v| {
+            misses += @intFromBool(cache.touch(v));
+        };
+    }
+    return @as(f64, @floatFromInt(misses)) / @as(f64, @floatFromInt(ebo.len));
+}
+
+/// Reorder the faces inside every range for the vertex cache, faceRange
+/// is the range of each loaded face, indices must be relative to the
+/// texture group. Faces keep their triangles together, so only
+/// facedraw.i3Index0 changes. Ranges are ordered on up to threads threads,
+/// the result does not depend on how many.
+pub fn orderFaces(ebo: [][3]u32, facedraw: []ld.ZigBSPFace, ranges: []const ld.ZigBSPFace, faceRange: []const u32, threads: usize) !void {
+    // faces of each range, as indices into facedraw
+    const first = try alloc.alloc(u32, ranges.len + 1);
+    defer alloc.free(first);
+    @memset(first, 0);
+    for (facedraw, faceRange) |fd, r| if (fd.n3Indexs > 0) {
+        first[r + 1] += 1;
+    };
+    for (1..first.len) |g| first[g] += first[g - 1];
+    const faces = try alloc.alloc(u32, first[ranges.len]);
+    defer alloc.free(faces);
+    const fill = try alloc.alloc(u32, ranges.len);
+    defer alloc.free(fill);
+    @memcpy(fill, first[0..ranges.len]);
+    for (facedraw, faceRange, 0..) |fd, r, f| if (fd.n3Indexs > 0) {
+        faces[fill[r]] = @intCast(f);
+        fill[r] += 1;
+    };
+
+    // a Tipsify and scratch space for the largest range per thread
+    const workers = @min(threads, @max(ranges.len, 1));
+    var maxtris: usize = 0;
+    for (ranges) |r| maxtris = @max(maxtris, r.n3Indexs);
+    const nverts = if (ebo.len > 0) maxIndex(ebo) + 1 else 0;
+    const tipsifys = try alloc.alloc(Tipsify, workers);
+    defer alloc.free(tipsifys);
+    var ready: usize = 0;
+    defer for (tipsifys[0..ready]) |*t| t.deinit();
+    while (ready < workers) : (ready += 1) tipsifys[ready] = try Tipsify.init(nverts);
+    const scratch = try alloc.alloc([3]u32, maxtris * workers);
+    defer alloc.free(scratch);
+
+    var order = Order{
+        .ebo = ebo,
+        .facedraw = facedraw,
+        .ranges = ranges,
+        .first = first,
+        .faces = faces,
+        .tipsifys = tipsifys,
+        .scratch = scratch,
+        .maxtris = maxtris,
+    };
+    par.forEach(workers, ranges.len, &order, Order.run);
+    if (order.failed.load(.Monotonic)) return error.OutOfMemory;
+}
+
+/// ranges are disjoint in ebo and facedraw, so each one is ordered alone
+const Order = struct {
+    ebo: [][3]u32,
+    facedraw: []ld.ZigBSPFace,
+    ranges: []const ld.ZigBSPFace,
+    first: []const u32, // faces of range g are faces[first[g]..first[g + 1]]
+    faces: []const u32,
+    tipsifys: []Tipsify, // per worker
+    scratch: [][3]u32, // maxtris per worker
+    maxtris: usize,
+    failed: std.atomic.Atomic(bool) = std.atomic.Atomic(bool).init(false),
+
+    fn run(self: *Order, worker: usize, g: usize) void {
+        self.orderRange(worker, g) catch self.failed.store(true, .Monotonic);
+    }
+
+    fn orderRange(self: *Order, worker: usize, g: usize) !void {
+        const range = self.ranges[g];
+        const tris = self.ebo[range.i3Index0..][0..range.n3Indexs];
+        const gfaces = self.faces[self.first[g]..self.first[g + 1]];
+        const order = try self.tipsifys[worker].run(tris, range.i3Index0, self.facedraw, gfaces);
+        // move triangles of the faces in the new order
+        const out = self.scratch[worker * self.maxtris ..][0..tris.len];
+        var n: u32 = 0;
+        for (order) |fi| {
+            const fd = &self.facedraw[gfaces[fi]];
+            @memcpy(out[n..][0..fd.n3Indexs], self.ebo[fd.i3Index0..][0..fd.n3Indexs]);
+            fd.i3Index0 = range.i3Index0 + n;
+            n += fd.n3Indexs;
+        }
+        @memcpy(tris, out);
+    }
+};
+
+/// Tipsify with faces instead of triangles: emit every face around the
+/// fanning vertex, then go on with a vertex of those faces that is still
+/// going to be in the cache after its own faces, or backtrack.
+const Tipsify = struct {
+    live: []u32, // triangles not emitted yet, per vertex
+    adjFirst: []u32, // nverts + 1, faces per vertex in adj
+    adj: std.ArrayList(u32),
+    emitted: std.ArrayList(bool),
+    order: std.ArrayList(u32),
+    dead: std.ArrayList(u32), // dead-end stack
+    candidates: std.ArrayList(u32),
+    cache: Cache,
+
+    fn init(nverts: usize) !Tipsify {
+        const live = try alloc.alloc(u32, nverts);
+        errdefer alloc.free(live);
+        const adjFirst = try alloc.alloc(u32, nverts + 1);
+        errdefer alloc.free(adjFirst);
+        return .{
+            .live = live,
+            .adjFirst = adjFirst,
+            .adj = std.ArrayList(u32).init(alloc),
+            .emitted = std.ArrayList(bool).init(alloc),
+            .order = std.ArrayList(u32).init(alloc),
+            .dead = std.ArrayList(u32).init(alloc),
+            .candidates = std.ArrayList(u32).init(alloc),
+            .cache = try Cache.init(nverts),
+        };
+    }
+
+    fn deinit(self: *Tipsify) void {
+        alloc.free(self.live);
+        alloc.free(self.adjFirst);
+        self.adj.deinit();
+        self.emitted.deinit();
+        self.order.deinit();
+        self.dead.deinit();
+        self.candidates.deinit();
+        self.cache.deinit();
+    }
+
+    /// returns the new order, as indices into gfaces
+    fn run(self: *Tipsify, tris: []const [3]u32, base: u32, facedraw: []const ld.ZigBSPFace, gfaces: []const u32) ![]const u32 {
+        const nverts = if (tris.len > 0) maxIndex(tris) + 1 else 0;
+        const live = self.live[0..nverts];
+        const adjFirst = self.adjFirst[0 .. nverts + 1];
+
+        // vertex to face adjacency, a face once per triangle using the vertex
+        @memset(live, 0);
+        for (tris) |t| for (t) |v| {
+            live[v] += 1;
+        };
+        adjFirst[0] = 0;
+        for (live, 0..) |l, v| adjFirst[v + 1] = adjFirst[v] + l;
+        try self.adj.resize(tris.len * 3);
+        @memset(live, 0);
+        for (gfaces, 0..) |f, fi| {
+            const fd = facedraw[f];
+            for (tris[fd.i3Index0 - base ..][0..fd.n3Indexs]) |t| for (t) |v| {
+                self.adj.items[adjFirst[v] + live[v]] = @intCast(fi);
+                live[v] += 1;
+            };
+        }
+
+        try self.emitted.resize(gfaces.len);
+        @memset(self.emitted.items, false);
+        self.order.clearRetainingCapacity();
+        self.dead.clearRetainingCapacity();
+        self.cache.flush();
+        var cursor: u32 = 0;
+        var fanning: ?u32 = if (nverts > 0) 0 else null;
+        while (fanning) |fv| {
+            self.candidates.clearRetainingCapacity();
+            for (self.adj.items[adjFirst[fv]..adjFirst[fv + 1]]) |fi| {
+                if (self.emitted.items[fi]) continue;
+                self.emitted.items[fi] = true;
+                try self.order.append(fi);
+                const fd = facedraw[gfaces[fi]];
+                for (tris[fd.i3Index0 - base ..][0..fd.n3Indexs]) |t| for (t) |v| {
+                    try self.dead.append(v);
+                    try self.candidates.append(v);
+                    live[v] -= 1;
+                    _ = self.cache.touch(v);
+                };
+            }
+            fanning = self.next(live, &cursor);
+        }
+        return self.order.items;
+    }
+
+    fn next(self: *Tipsify, live: []const u32, cursor: *u32) ?u32 {
+        // oldest candidate that stays in the cache, with 2 misses per triangle left
+        var best: ?u32 = null;
+        var bestAge: u32 = 0;
+        for (self.candidates.items) |v| {
+            if (live[v] == 0) continue;
+            const age = self.cache.age(v);
+            const prio = if (age + 2 * live[v] <= cache_size) age else 0;
+            if (best == null or prio > bestAge) {
+                best = v;
+                bestAge = prio;
+            }
+        }
+        if (best != null) return best;
+        while (self.dead.popOrNull()) |v|
+            if (live[v] > 0) return v;
+        while (cursor.* < live.len) : (cursor.* += 1)
+            if (live[cursor.*] > 0) return cursor.*;
+        return null;
+    }
+};
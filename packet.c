@@ -0,0 +1,239 @@
+#include <string.h>
+#include "bsp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PACKET_X86
+#include <immintrin.h>
+#endif
+
+#define MAX_LANES 8
+
+// SoA copy of up to MAX_LANES queries, unused lanes are zero
+typedef struct {
+    _Alignas(32) float x1[MAX_LANES];
+    _Alignas(32) float y1[MAX_LANES];
+    _Alignas(32) float z1[MAX_LANES];
+    _Alignas(32) float x2[MAX_LANES];
+    _Alignas(32) float y2[MAX_LANES];
+    _Alignas(32) float z2[MAX_LANES];
+} packet_t;
+
+// lanes waiting to go down another child
+typedef struct {
+    int32_t node;
+    uint32_t mask;
+} lanes_t;
+
+#define EACH_LANE(i, mask) \
+    for (uint32_t m_ = (mask), i; m_ && (i = __builtin_ctz(m_), 1); m_ &= m_ - 1)
+
+// plane distances are computed as ((n0 * x + n1 * y) + n2 * z) - d,
+// the same order as the scalar glm_vec3_dot, and without FMA; for axial
+// planes that is exactly the shortcut of the scalar hullDist
+
+#define DEFINE_PACKET_KERNELS(SFX, ATTR)                                                              \
+    ATTR static void pointPacket##SFX(ZigLoadBSP *bsp, int32_t root, uint32_t n,                      \
+                                      const packet_t *pk, int32_t *out) {                             \
+        VF x = V_LOAD(pk->x1), y = V_LOAD(pk->y1), z = V_LOAD(pk->z1);                                \
+        lanes_t stack[MAX_LANES];                                                                     \
+        int sp = 0;                                                                                   \
+        int32_t node = root;                                                                          \
+        uint32_t mask = (1u << n) - 1;                                                                \
+        while (true) {                                                                                \
+            while (node >= 0) {                                                                       \
+                hullnode_t *c = bsp->hullnode + node;                                                 \
+                VF d = V_SUB(V_ADD(V_ADD(V_MUL(V_SET1(c->n[0]), x), V_MUL(V_SET1(c->n[1]), y)),       \
+                                   V_MUL(V_SET1(c->n[2]), z)),                                        \
+                             V_SET1(c->d));                                                           \
+                uint32_t back = V_MOVEMASK(V_CMPLT(d, V_ZERO())) & mask;                              \
+                if (back == 0) {                                                                      \
+                    node = c->iChilds[0];                                                             \
+                } else if (back == mask) {                                                            \
+                    node = c->iChilds[1];                                                             \
+                } else {                                                                              \
+                    stack[sp++] = (lanes_t){c->iChilds[1], back};                                     \
+                    mask &= ~back;                                                                    \
+                    node = c->iChilds[0];                                                             \
+                }                                                                                     \
+            }                                                                                         \
+            EACH_LANE(i, mask)                                                                        \
+            out[i] = node;                                                                            \
+            if (sp == 0)                                                                              \
+                break;                                                                                \
+            sp--;                                                                                     \
+            node = stack[sp].node;                                                                    \
+            mask = stack[sp].mask;                                                                    \
+        }                                                                                             \
+    }                                                                                                 \
+                                                                                                      \
+    /* lanes go on alone with the scalar trace from the first node they cross, */                    \
+    /* which is exactly where PM_RecursiveHullCheck starts to split */                               \
+    ATTR static void tracePacket##SFX(ZigLoadBSP *bsp, int32_t hull, uint32_t n, const packet_t *pk, \
+                                      const tracequery_t *q, pmtrace_t *out) {                        \
+        VF x1 = V_LOAD(pk->x1), y1 = V_LOAD(pk->y1), z1 = V_LOAD(pk->z1);                             \
+        VF x2 = V_LOAD(pk->x2), y2 = V_LOAD(pk->y2), z2 = V_LOAD(pk->z2);                             \
+        lanes_t stack[MAX_LANES];                                                                     \
+        int sp = 0;                                                                                   \
+        int32_t node = bsp->hroot[hull];                                                              \
+        uint32_t mask = (1u << n) - 1;                                                                \
+        while (true) {                                                                                \
+            while (node >= 0 && mask) {                                                               \
+                hullnode_t *c = bsp->hullnode + node;                                                 \
+                VF nx = V_SET1(c->n[0]), ny = V_SET1(c->n[1]), nz = V_SET1(c->n[2]);                  \
+                VF t1 = V_SUB(V_ADD(V_ADD(V_MUL(x1, nx), V_MUL(y1, ny)), V_MUL(z1, nz)), V_SET1(c->d)); \
+                VF t2 = V_SUB(V_ADD(V_ADD(V_MUL(x2, nx), V_MUL(y2, ny)), V_MUL(z2, nz)), V_SET1(c->d)); \
+                uint32_t front = V_MOVEMASK(V_AND(V_CMPGE(t1, V_ZERO()), V_CMPGE(t2, V_ZERO()))) & mask; \
+                uint32_t back = V_MOVEMASK(V_AND(V_CMPLT(t1, V_ZERO()), V_CMPLT(t2, V_ZERO()))) & mask; \
+                EACH_LANE(i, mask & ~(front | back))                                                  \
+                PM_TraceFrom(bsp, hull, node, (float *)q[i].start, (float *)q[i].end, out + i);       \
+                if (front && back)                                                                    \
+                    stack[sp++] = (lanes_t){c->iChilds[1], back};                                     \
+                mask = front ? front : back;                                                          \
+                node = c->iChilds[front ? 0 : 1];                                                     \
+            }                                                                                         \
+            EACH_LANE(i, mask)                                                                        \
+            PM_TraceFrom(bsp, hull, node, (float *)q[i].start, (float *)q[i].end, out + i);           \
+            if (sp == 0)                                                                              \
+                break;                                                                                \
+            sp--;                                                                                     \
+            node = stack[sp].node;                                                                    \
+            mask = stack[sp].mask;                                                                    \
+        }                                                                                             \
+    }
+
+#ifdef PACKET_X86
+
+#define VF __m128
+#define V_LOAD _mm_load_ps
+#define V_SET1 _mm_set1_ps
+#define V_ZERO _mm_setzero_ps
+#define V_MUL _mm_mul_ps
+#define V_ADD _mm_add_ps
+#define V_SUB _mm_sub_ps
+#define V_AND _mm_and_ps
+#define V_CMPLT _mm_cmplt_ps
+#define V_CMPGE _mm_cmpge_ps
+#define V_MOVEMASK _mm_movemask_ps
+DEFINE_PACKET_KERNELS(SSE, __attribute__((target("sse2"))))
+#undef VF
+#undef V_LOAD
+#undef V_SET1
+#undef V_ZERO
+#undef V_MUL
+#undef V_ADD
+#undef V_SUB
+#undef V_AND
+#undef V_CMPLT
+#undef V_CMPGE
+#undef V_MOVEMASK
+
+#define VF __m256
+#define V_LOAD _mm256_load_ps
+#define V_SET1 _mm256_set1_ps
+#define V_ZERO _mm256_setzero_ps
+#define V_MUL _mm256_mul_ps
+#define V_ADD _mm256_add_ps
+#define V_SUB _mm256_sub_ps
+#define V_AND _mm256_and_ps
+#define V_CMPLT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define V_CMPGE(a, b) _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define V_MOVEMASK _mm256_movemask_ps
+DEFINE_PACKET_KERNELS(AVX2, __attribute__((target("avx2"))))
+
+#endif
+
+packetmode_t PM_PacketMode(void) {
+#ifdef PACKET_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return PACKET_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return PACKET_SSE;
+#endif
+    return PACKET_SCALAR;
+}
+
+typedef struct {
+    ZigLoadBSP *bsp;
+    const void *queries;
+    void *results;
+    packetmode_t mode;
+} pbatch_t;
+
+static void pointChunkPacked(void *ctx, size_t begin, size_t end) {
+    pbatch_t *b = ctx;
+    const pointquery_t *q = b->queries;
+    int32_t *r = b->results;
+    packet_t pk;
+    for (size_t i = begin; i < end;) {
+        if (b->mode == PACKET_SCALAR) {
+            r[i] = PM_HullPointContents(b->bsp, b->bsp->hroot[q[i].hull], (float *)q[i].pos);
+            i++;
+            continue;
+        }
+        uint32_t n = 1;
+        while (n < (uint32_t)b->mode && i + n < end && q[i + n].hull == q[i].hull)
+            n++;
+        memset(&pk, 0, sizeof(pk));
+        for (uint32_t k = 0; k < n; k++) {
+            pk.x1[k] = q[i + k].pos[0];
+            pk.y1[k] = q[i + k].pos[1];
+            pk.z1[k] = q[i + k].pos[2];
+        }
+#ifdef PACKET_X86
+        if (b->mode == PACKET_AVX2)
+            pointPacketAVX2(b->bsp, b->bsp->hroot[q[i].hull], n, &pk, r + i);
+        else
+            pointPacketSSE(b->bsp, b->bsp->hroot[q[i].hull], n, &pk, r + i);
+#endif
+        i += n;
+    }
+}
+
+static void traceChunkPacked(void *ctx, size_t begin, size_t end) {
+    pbatch_t *b = ctx;
+    const tracequery_t *q = b->queries;
+    pmtrace_t *r = b->results;
+    packet_t pk;
+    for (size_t i = begin; i < end;) {
+        if (b->mode == PACKET_SCALAR) {
+            PM_TraceLine(b->bsp, q[i].hull, (float *)q[i].start, (float *)q[i].end, r + i);
+            i++;
+            continue;
+        }
+        uint32_t n = 1;
+        while (n < (uint32_t)b->mode && i + n < end && q[i + n].hull == q[i].hull)
+            n++;
+        memset(&pk, 0, sizeof(pk));
+        for (uint32_t k = 0; k < n; k++) {
+            pk.x1[k] = q[i + k].start[0];
+            pk.y1[k] = q[i + k].start[1];
+            pk.z1[k] = q[i + k].start[2];
+            pk.x2[k] = q[i + k].end[0];
+            pk.y2[k] = q[i + k].end[1];
+            pk.z2[k] = q[i + k].end[2];
+        }
+#ifdef PACKET_X86
+        if (b->mode == PACKET_AVX2)
+            tracePacketAVX2(b->bsp, q[i].hull, n, &pk, q + i, r + i);
+        else
+            tracePacketSSE(b->bsp, q[i].hull, n, &pk, q + i, r + i);
+#endif
+        i += n;
+    }
+}
+
+static packetmode_t clampMode(packetmode_t mode) {
+    packetmode_t best = PM_PacketMode();
+    return mode > best ? best : mode;
+}
+
+void PM_TraceBatchPacked(pool_t *pool, ZigLoadBSP *bsp, const tracequery_t *queries, pmtrace_t *results, size_t count, packetmode_t mode) {
+    pbatch_t b = {bsp, queries, results, clampMode(mode)};
+    poolFor(pool, count, 256, traceChunkPacked, &b);
+}
+
+void PM_PointContentsBatchPacked(pool_t *pool, ZigLoadBSP *bsp, const pointquery_t *queries, int32_t *results, size_t count, packetmode_t mode) {
+    pbatch_t b = {bsp, queries, results, clampMode(mode)};
+    poolFor(pool, count, 1024, pointChunkPacked, &b);
+}
@@ -0,0 +1,39 @@
+//! Fork-join loops for the loader: the calling thread and the workers take
+//! items off one counter until none are left.
+const std = @import("std");
+
+/// threads to use when asked for want, 0 is one per core
+pub fn threadCount(want: usize) usize {
+    const n = if (want != 0) want else std.Thread.getCpuCount() catch 1;
+    return @max(n, 1);
+}
+
+/// call func(ctx, worker, i) for every i < count on up to threads threads,
+/// worker < threads tells which thread runs the item, for per-thread state
+pub fn forEach(threads: usize, count: usize, ctx: anytype, comptime func: anytype) void {
+    const Loop = struct {
+        ctx: @TypeOf(ctx),
+        count: usize,
+        next: std.atomic.Atomic(usize) = std.atomic.Atomic(usize).init(0),
+
+        fn run(self: *@This(), worker: usize) void {
+            while (true) {
+                const i = self.next.fetchAdd(1, .Monotonic);
+                if (i >= self.count) return;
+                func(self.ctx, worker, i);
+            }
+        }
+    };
+    var loop = Loop{ .ctx = ctx, .count = count };
+    const pool = std.heap.c_allocator.alloc(std.Thread, @min(threads, count) -| 1) catch {
+        // without memory for the handles the calling thread does it all
+        loop.run(0);
+        return;
+    };
+    defer std.heap.c_allocator.free(pool);
+    var spawned: usize = 0;
+    while (spawned < pool.len) : (spawned += 1)
+        pool[spawned] = std.Thread.spawn(.{}, Loop.run, .{ &loop, spawned + 1 }) catch break;
+    loop.run(0);
+    for (pool[0..spawned]) |t| t.join();
+}
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string.h>
+#include "player.h"
+
+void angle_vectors(vec3 degs, float *f, float *s, float *u) {
+    float y = glm_rad(degs[0]);
+    float p = glm_rad(degs[1]);
+    float r = glm_rad(degs[2]);
+    float sr = sin(r), sp = sin(p), sy = sin(y);
+    float cr = cos(r), cp = cos(p), cy = cos(y);
+    if (f) {
+        f[0] = cp * cy;
+        f[1] = cp * sy;
+        f[2] = -sp;
+    }
+    if (s) {
+        s[0] = -sr * sp * cy + cr * sy;
+        s[1] = -sr * sp * sy - cr * cy;
+        s[2] = -sr * cp;
+    }
+    if (u) {
+        u[0] = cr * sp * cy + sr * sy;
+        u[1] = cr * sp * sy - sr * cy;
+        u[2] = cr * cp;
+    }
+}
+
+static void mv_friction(vec3 vel, float dt, float stopspeed, float friction, float surfaceFriction) {
+    float spd = glm_vec3_norm(vel);
+    if (spd < 0.1)
+        return;
+    float ctrl = GLM_MAX(stopspeed, spd);
+    float drop = dt * ctrl * friction * surfaceFriction;
+    glm_vec3_scale(vel, GLM_MAX(0.0, spd - drop) / spd, vel);
+}
+
+static void mv_accelerate(vec3 vel, float dt, vec3 wishdir, float wishspd, float accel, float surfaceFriction) {
+    float speed = glm_vec3_dot(vel, wishdir);
+    float acc_1 = GLM_MAX(0.0, wishspd - speed);
+    float acc_2 = dt * wishspd * accel * surfaceFriction;
+    glm_vec3_muladds(wishdir, GLM_MIN(acc_1, acc_2), vel);
+}
+
+static void mv_airaccelerate(vec3 vel, float dt, vec3 wishdir, float wishspd, float aircap, float accel, float surfaceFriction) {
+    wishspd = glm_clamp(wishspd, 0, aircap);
+    float speed = glm_vec3_dot(vel, wishdir);
+    float acc_1 = GLM_MAX(0.0, wishspd - speed);
+    float acc_2 = dt * wishspd * accel * surfaceFriction;
+    glm_vec3_muladds(wishdir, GLM_MIN(acc_1, acc_2), vel);
+}
+
+static void calc_wishvel(player_t *pl, uint16_t buttons, vec3 wishdir, bool d3, float *wishspd,
+                         float forwardspeed, float sidespeed, float duckmod, float maxspeed) {
+    vec3 f, s;
+    angle_vectors(pl->ang, f, s, NULL);
+    if (!d3) {
+        f[2] = 0.0;
+        s[2] = 0.0;
+    }
+    glm_vec3_normalize(f);
+    glm_vec3_normalize(s);
+    glm_vec3_zero(wishdir);
+    if (buttons & BTN_FORWARD)
+        glm_vec3_muladds(f, +forwardspeed, wishdir);
+    if (buttons & BTN_BACK)
+        glm_vec3_muladds(f, -forwardspeed, wishdir);
+    if (buttons & BTN_LEFT)
+        glm_vec3_muladds(s, -sidespeed, wishdir);
+    if (buttons & BTN_RIGHT)
+        glm_vec3_muladds(s, +sidespeed, wishdir);
+    *wishspd = glm_vec3_norm(wishdir);
+    glm_vec3_normalize(wishdir);
+    *wishspd = glm_clamp(*wishspd, 0, maxspeed);
+    if (pl->bDucked)
+        *wishspd *= duckmod;
+}
+
+static const float sv_gravity = 800.0;
+static const float sv_maxspeed = 250.0;
+static const float cl_sidespeed = 450.0;
+static const float cl_forwardspeed = 450.0;
+static const float sv_stopspeed = 100.0;
+static const float sv_friction = 4.0;
+static const float sv_accelerate = 5.0;
+static const float sv_airaccelerate = 100.0;
+static const float sv_jump_impulse = 301.993377;
+static const float duck_time = 0.125;
+
+// hull queries of player_move, counted for the benchmarks
+static int32_t pmPointContents(ZigLoadBSP *bsp, player_t *pl, vec3 pos) {
+    pl->nTraces++;
+    return PM_PointContents(bsp, 0, pos);
+}
+
+static bool pmHullCheck(ZigLoadBSP *bsp, player_t *pl, float p1f, vec3 p1, vec3 p2, pmtrace_t *trace) {
+    pl->nTraces++;
+    return PM_RecursiveHullCheck(bsp, bsp->hroot[pl->hull], bsp->hroot[pl->hull], p1f, 1.0f, p1, p2, trace);
+}
+
+void player_move(ZigLoadBSP *bsp, player_t *pl, const usercmd_t *cmd, float dt) {
+    bool noclip = cmd->buttons & BTN_NOCLIP;
+    pl->ang[0] = cmd->yaw;
+    pl->ang[1] = cmd->pitch;
+    vec3 wishdir;
+    float wishspd;
+    calc_wishvel(pl, cmd->buttons, wishdir, noclip, &wishspd, cl_forwardspeed, cl_sidespeed, 0.34, sv_maxspeed);
+
+    if (noclip) {
+        glm_vec3_scale(wishdir, wishspd, pl->vel);
+    } else {
+        if (pl->bGround) {
+            mv_friction(pl->vel, dt, sv_stopspeed, sv_friction, 1.0);
+            mv_accelerate(pl->vel, dt, wishdir, wishspd, sv_accelerate, 1.0);
+        } else {
+            mv_airaccelerate(pl->vel, dt, wishdir, wishspd, 30.0, sv_airaccelerate, 1.0);
+            pl->vel[2] -= sv_gravity * dt / 2;
+        }
+        {
+            bool wantJump = cmd->buttons & (BTN_JUMP | BTN_SCROLLDN);
+            bool should_J = wantJump && !pl->bPrevJ;
+            pl->bPrevJ = wantJump;
+            if (pl->bGround && should_J) {
+                if (pl->verbose)
+                    fprintf(stderr, "prespeed: %.3f\n", glm_vec2_norm(pl->vel));
+                glm_vec3_copy(pl->pos, pl->jumpOff);
+                pl->vel[2] = sv_jump_impulse;
+            }
+        }
+        {
+            bool wantDuck = cmd->buttons & (BTN_DUCK | BTN_SCROLLUP);
+            if (wantDuck) {
+                if (pl->bGround) {
+                    pl->bInDuck = true;
+                    pl->flDuckAmount = glm_clamp(pl->flDuckAmount + dt / duck_time, 0.0, 1.0);
+                    if (pl->flDuckAmount == 1.0) {
+                        pl->bInDuck = false;
+                        if (!pl->bDucked) {
+                            pl->bDucked = true;
+                            pl->pos[2] -= 18.0;
+                            pl->hull = 2;
+                        }
+                    }
+                } else {
+                    if (!pl->bDucked) {
+                        pl->bDucked = true;
+                        pl->bInDuck = false;
+                        pl->hull = 2;
+                        pl->flDuckAmount = 1.0;
+                    }
+                }
+            } else {
+                if (pl->bGround) {
+                    // can unduck
+                    if (pmPointContents(bsp, pl, (vec3){pl->pos[0], pl->pos[1], pl->pos[2] + 18.0}) == CONTENTS_EMPTY) {
+                        pl->flDuckAmount = glm_clamp(pl->flDuckAmount - dt / duck_time, 0.0, 1.0);
+                        if (pl->bInDuck || pl->bDucked) {
+                            pl->hull = 0;
+                            pl->pos[2] += 18.0;
+                            pl->bInDuck = false;
+                            pl->bDucked = false;
+                            if (pl->verbose)
+                                fprintf(stderr, "unduck ground\n");
+                        }
+                    } else {
+                        pl->flDuckAmount = glm_clamp(pl->flDuckAmount + dt / duck_time, 0.0, 1.0);
+                        pl->bInDuck = true;
+                    }
+                } else {
+                    // can unduck
+                    if (pl->flDuckAmount > 0.0 && pmPointContents(bsp, pl, pl->pos) == CONTENTS_EMPTY) {
+                        pl->hull = 0;
+                        pl->bDucked = false;
+                        pl->bInDuck = false;
+                        pl->flDuckAmount = 0.0;
+                    }
+                }
+            }
+        }
+    }
+
+    float frac = 0.0f;
+    float curr_pos[3];
+    float next_pos[3];
+    glm_vec3_copy(pl->pos, curr_pos);
+    for (int i = 0; i < 4; i++) {
+        // next_pos if not clipped
+        glm_vec3_copy(curr_pos, next_pos);
+        glm_vec3_muladds(pl->vel, (1.0f - frac) * dt, next_pos);
+        // trace curr_pos -> next_pos
+        pmtrace_t trace;
+        memset(&trace, 0, sizeof(trace));
+        if (noclip || pmHullCheck(bsp, pl, frac, curr_pos, next_pos, &trace)) { // full move
+            if (trace.startsolid && !noclip)
+                break;
+            frac = 1.0;
+            glm_vec3_copy(next_pos, pl->pos);
+            break;
+        }
+        // clip vel
+        float backoff = glm_vec3_dot(trace.plane.n, pl->vel);
+        if (backoff < 0) {
+            // fprintf(stderr, "normal:\n");
+            // glm_vec3_print(trace.plane.n, stderr);
+            // fprintf(stderr, "speed:\n");
+            // glm_vec3_print(pl->vel, stderr);
+            // fprintf(stderr, "dist: %f\n", glm_vec3_dot(pl->pos, trace.plane.n) - trace.plane.d);
+            glm_vec3_muladds(trace.plane.n, -backoff, pl->vel);
+        }
+        // use endpos as next_pos
+        frac = trace.fraction;
+        glm_vec3_copy(trace.endpos, next_pos);
+        glm_vec3_copy(trace.endpos, pl->pos);
+    }
+
+    // if (frac < 1.0) {
+    //     fprintf(stderr, "frac: %.3f\n", frac);
+    //     glm_vec3_print(pl->vel, stderr);
+    // }
+
+    pl->bGround = false;
+    if (!noclip) {
+        pmtrace_t trace;
+        glm_vec3_add(pl->pos, (vec3){0.0, 0.0, -2.0}, next_pos);
+        if (!pmHullCheck(bsp, pl, 0.0, pl->pos, next_pos, &trace)) {
+            if (trace.plane.n[2] > 0.7 && pl->vel[2] < 180.0)
+                pl->bGround = true;
+        }
+        if (!pl->bGround)
+            pl->vel[2] -= sv_gravity * dt / 2;
+    }
+}
+
+void player_eye(const player_t *pl, vec3 eye) {
+    eye[0] = pl->pos[0];
+    eye[1] = pl->pos[1];
+    eye[2] = pl->pos[2] - (pl->hull == 0 ? 36.0 : 18.0) + 36.0 * (1.0 - pl->flDuckAmount) + 28.0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "bsp.h"
+
+enum {
+    BTN_FORWARD = 1 << 0,
+    BTN_BACK = 1 << 1,
+    BTN_LEFT = 1 << 2,
+    BTN_RIGHT = 1 << 3,
+    BTN_DUCK = 1 << 4,
+    BTN_JUMP = 1 << 5,
+    BTN_SCROLLUP = 1 << 6,
+    BTN_SCROLLDN = 1 << 7,
+    BTN_NOCLIP = 1 << 8,
+};
+
+// input of one tick
+typedef struct {
+    float yaw, pitch;
+    uint16_t buttons; // BTN_*
+} usercmd_t;
+
+// movement state of one player, everything player_move changes; the bsp
+// is only read, so players can move on many threads at once
+typedef struct {
+    vec3 pos;
+    vec3 ang;
+    vec3 vel;
+    vec3 jumpOff;
+    float flDuckAmount;
+    int hull;
+    bool bPrevJ;  // pressed jump
+    bool bGround;
+    bool bDucked; // ducked
+    bool bInDuck; // duck transition
+    bool verbose; // print prespeed and unducks
+    uint32_t nTraces; // hull queries by player_move
+} player_t;
+
+void angle_vectors(vec3 degs, float *f, float *s, float *u);
+void player_move(ZigLoadBSP *bsp, player_t *pl, const usercmd_t *cmd, float dt);
+void player_eye(const player_t *pl, vec3 eye);
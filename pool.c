@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pool.h"
+
+// each thread owns a slice of the range and takes chunks from its front,
+// when it runs dry it takes chunks from the other slices the same way
+typedef struct {
+    _Alignas(64) atomic_size_t next;
+    size_t end;
+} slice_t;
+
+struct pool {
+    int nThreads;
+    pthread_t *threads;
+    slice_t *slices;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    unsigned generation; // bumped per job
+    int running;         // workers still in the current job
+    bool quit;
+    // current job
+    pool_fn fn;
+    void *ctx;
+    size_t grain;
+};
+
+typedef struct {
+    pool_t *pool;
+    int index;
+} worker_t;
+
+static void runJob(pool_t *pool, int self) {
+    for (int k = 0; k < pool->nThreads; k++) {
+        slice_t *s = pool->slices + (self + k) % pool->nThreads;
+        while (true) {
+            size_t b = atomic_fetch_add_explicit(&s->next, pool->grain, memory_order_relaxed);
+            if (b >= s->end)
+                break;
+            size_t e = b + pool->grain < s->end ? b + pool->grain : s->end;
+            pool->fn(pool->ctx, b, e);
+        }
+    }
+}
+
+static void *workerMain(void *arg) {
+    worker_t *w = arg;
+    pool_t *pool = w->pool;
+    unsigned seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        if (pool->quit)
+            break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+        runJob(pool, w->index);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    free(w);
+    return NULL;
+}
+
+pool_t *poolCreate(int threads) {
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+    pool_t *pool = calloc(1, sizeof(pool_t));
+    if (!pool)
+        return NULL;
+    pool->nThreads = threads;
+    pool->threads = calloc(threads, sizeof(pthread_t));
+    pool->slices = aligned_alloc(_Alignof(slice_t), sizeof(slice_t) * threads);
+    if (!pool->threads || !pool->slices) {
+        free(pool->threads);
+        free(pool->slices);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int i = 1; i < threads; i++) {
+        worker_t *w = malloc(sizeof(worker_t));
+        if (!w) {
+            pool->nThreads = i;
+            break;
+        }
+        w->pool = pool;
+        w->index = i;
+        if (pthread_create(pool->threads + i, NULL, workerMain, w) != 0) {
+            // run with the threads we got
+            free(w);
+            pool->nThreads = i;
+            break;
+        }
+    }
+    return pool;
+}
+
+void poolDestroy(pool_t *pool) {
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i < pool->nThreads; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->slices);
+    free(pool->threads);
+    free(pool);
+}
+
+int poolSize(pool_t *pool) {
+    return pool ? pool->nThreads : 1;
+}
+
+void poolFor(pool_t *pool, size_t count, size_t grain, pool_fn fn, void *ctx) {
+    if (count == 0)
+        return;
+    if (grain == 0)
+        grain = 1;
+    if (!pool || pool->nThreads == 1 || count <= grain) {
+        for (size_t b = 0; b < count; b += grain)
+            fn(ctx, b, b + grain < count ? b + grain : count);
+        return;
+    }
+    int n = pool->nThreads;
+    for (int i = 0; i < n; i++) {
+        atomic_store_explicit(&pool->slices[i].next, count * i / n, memory_order_relaxed);
+        pool->slices[i].end = count * (i + 1) / n;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->ctx = ctx;
+    pool->grain = grain;
+    pool->running = n - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    runJob(pool, 0);
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
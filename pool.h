@@ -0,0 +1,15 @@
+#pragma once
+#include <stddef.h>
+
+// work-stealing parallel for, the calling thread works as thread 0
+
+typedef struct pool pool_t;
+typedef void (*pool_fn)(void *ctx, size_t begin, size_t end);
+
+// threads <= 0: one per online cpu; NULL if out of memory, the functions
+// below take NULL as a pool of only the calling thread
+pool_t *poolCreate(int threads);
+void poolDestroy(pool_t *pool);
+int poolSize(pool_t *pool);
+// call fn on chunks of at most grain items until [0, count) is done
+void poolFor(pool_t *pool, size_t count, size_t grain, pool_fn fn, void *ctx);
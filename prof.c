@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GLFW/glfw3.h>
+#include "prof.h"
+
+static const char *stageNames[PROF_STAGES] = {"events", "move", "cull", "draw", "swap", "stream"};
+
+void profInit(prof_t *p, uint32_t frames) {
+    memset(p, 0, sizeof(*p));
+    p->cap = frames > 0 ? frames : 1;
+    p->ring = calloc(p->cap, sizeof(profframe_t));
+    p->cur = p->ring;
+    p->cur->gpu = -1.0f;
+    // core since 3.3
+    p->gpuTimer = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if (p->gpuTimer)
+        glGenQueries(PROF_QUERIES, p->queries);
+}
+
+void profFree(prof_t *p) {
+    if (p->gpuTimer)
+        glDeleteQueries(PROF_QUERIES, p->queries);
+    free(p->ring);
+}
+
+// results of earlier frames, if they are in and the frame is still kept
+static void collectQueries(prof_t *p) {
+    for (int q = 0; q < PROF_QUERIES; q++) {
+        if (!p->queryBusy[q])
+            continue;
+        GLint ready = 0;
+        glGetQueryObjectiv(p->queries[q], GL_QUERY_RESULT_AVAILABLE, &ready);
+        if (!ready)
+            continue;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(p->queries[q], GL_QUERY_RESULT, &ns);
+        p->queryBusy[q] = false;
+        if (p->frames - p->queryFrame[q] < p->cap)
+            p->ring[p->queryFrame[q] % p->cap].gpu = ns * 1e-6;
+    }
+}
+
+void profFrame(prof_t *p) {
+    double t = glfwGetTime();
+    if (p->started) {
+        p->cur->frame = (t - p->frameStart) * 1e3;
+        p->frames++;
+        p->cur = p->ring + p->frames % p->cap;
+        memset(p->cur, 0, sizeof(*p->cur));
+        p->cur->gpu = -1.0f;
+    }
+    p->started = true;
+    p->frameStart = t;
+    if (p->gpuTimer)
+        collectQueries(p);
+}
+
+void profBegin(prof_t *p, profstage_t stage) {
+    p->stageStart[stage] = glfwGetTime();
+}
+
+void profEnd(prof_t *p, profstage_t stage) {
+    p->cur->cpu[stage] += (glfwGetTime() - p->stageStart[stage]) * 1e3;
+}
+
+// a frame goes without gpu time rather than wait for an old query
+void profGpuBegin(prof_t *p) {
+    int q = p->frames % PROF_QUERIES;
+    if (!p->gpuTimer || p->queryBusy[q])
+        return;
+    glBeginQuery(GL_TIME_ELAPSED, p->queries[q]);
+    p->queryBusy[q] = true;
+    p->queryFrame[q] = p->frames;
+}
+
+void profGpuEnd(prof_t *p) {
+    int q = p->frames % PROF_QUERIES;
+    if (p->gpuTimer && p->queryBusy[q] && p->queryFrame[q] == p->frames)
+        glEndQuery(GL_TIME_ELAPSED);
+}
+
+static uint32_t kept(const prof_t *p) {
+    return p->frames < p->cap ? p->frames : p->cap;
+}
+
+static const profframe_t *keptFrame(const prof_t *p, uint32_t i) {
+    return p->ring + (p->frames - kept(p) + i) % p->cap;
+}
+
+static int cmpFloat(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+void profSummary(const prof_t *p, profsummary_t *s) {
+    memset(s, 0, sizeof(*s));
+    uint32_t n = kept(p);
+    if (n == 0)
+        return;
+    float *times = malloc(sizeof(float) * n);
+    double sum = 0.0, gpuSum = 0.0;
+    uint32_t gpuN = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        const profframe_t *f = keptFrame(p, i);
+        times[i] = f->frame;
+        sum += f->frame;
+        if (f->gpu >= 0.0f) {
+            gpuSum += f->gpu;
+            gpuN++;
+        }
+    }
+    qsort(times, n, sizeof(float), cmpFloat);
+    s->frames = n;
+    s->avg = sum / n;
+    s->p50 = times[n * 50 / 100];
+    s->p90 = times[n * 90 / 100];
+    s->p99 = times[n * 99 / 100];
+    s->max = times[n - 1];
+    s->gpuAvg = gpuN > 0 ? gpuSum / gpuN : -1.0f;
+    free(times);
+}
+
+static bool endsWith(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+bool profDump(const prof_t *p, const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return false;
+    bool json = endsWith(path, ".json");
+    uint32_t n = kept(p);
+    uint64_t first = p->frames - n;
+    if (json) {
+        profsummary_t s;
+        profSummary(p, &s);
+        fprintf(fp, "{\"summary\": {\"frames\": %u, \"avg_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, "
+                    "\"p99_ms\": %.4f, \"max_ms\": %.4f, \"gpu_avg_ms\": %.4f},\n \"frames\": [",
+                s.frames, s.avg, s.p50, s.p90, s.p99, s.max, s.gpuAvg);
+    } else {
+        fprintf(fp, "frame,frame_ms");
+        for (int k = 0; k < PROF_STAGES; k++)
+            fprintf(fp, ",%s_ms", stageNames[k]);
+        fprintf(fp, ",gpu_ms,draws,tris,binds\n");
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const profframe_t *f = keptFrame(p, i);
+        if (json) {
+            fprintf(fp, "%s\n  {\"frame\": %llu, \"frame_ms\": %.4f", i ? "," : "", (unsigned long long)(first + i), f->frame);
+            for (int k = 0; k < PROF_STAGES; k++)
+                fprintf(fp, ", \"%s_ms\": %.4f", stageNames[k], f->cpu[k]);
+            fprintf(fp, ", \"gpu_ms\": %.4f, \"draws\": %u, \"tris\": %u, \"binds\": %u}", f->gpu, f->draws, f->tris, f->binds);
+        } else {
+            fprintf(fp, "%llu,%.4f", (unsigned long long)(first + i), f->frame);
+            for (int k = 0; k < PROF_STAGES; k++)
+                fprintf(fp, ",%.4f", f->cpu[k]);
+            fprintf(fp, ",%.4f,%u,%u,%u\n", f->gpu, f->draws, f->tris, f->binds);
+        }
+    }
+    if (json)
+        fprintf(fp, "\n ]}\n");
+    return fclose(fp) == 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <GL/glew.h>
+
+// frame profiler: cpu time per stage, gpu time of the draws from
+// GL_TIME_ELAPSED queries and draw counters, kept for the last frames
+
+typedef enum {
+    PROF_EVENTS, // glfwPollEvents, when input is on the render thread
+    PROF_MOVE,   // player_move, when movement is on the render thread
+    PROF_CULL,   // view leaf, PVS and drawlist
+    PROF_DRAW,   // draw submission
+    PROF_SWAP,   // glfwSwapBuffers
+    PROF_STREAM, // uploads of the next map
+    PROF_STAGES,
+} profstage_t;
+
+typedef struct {
+    float cpu[PROF_STAGES]; // ms
+    float frame;            // ms, start to start of the next frame
+    float gpu;              // ms, < 0 if there is no result
+    uint32_t draws;         // draw calls
+    uint32_t tris;
+    uint32_t binds;         // texture binds
+} profframe_t;
+
+// results are read a few frames later, so the gpu never waits on the cpu
+#define PROF_QUERIES 4
+
+typedef struct {
+    profframe_t *ring;
+    uint32_t cap;
+    uint64_t frames; // done, the current one is ring[frames % cap]
+    profframe_t *cur;
+    bool started;
+    double frameStart;
+    double stageStart[PROF_STAGES];
+    bool gpuTimer;
+    GLuint queries[PROF_QUERIES];
+    uint64_t queryFrame[PROF_QUERIES];
+    bool queryBusy[PROF_QUERIES];
+} prof_t;
+
+typedef struct {
+    uint32_t frames;
+    float avg, p50, p90, p99, max; // frame ms
+    float gpuAvg;                  // ms, of frames with a result
+} profsummary_t;
+
+void profInit(prof_t *p, uint32_t frames);
+void profFree(prof_t *p);
+void profFrame(prof_t *p); // end the current frame and start the next
+void profBegin(prof_t *p, profstage_t stage);
+void profEnd(prof_t *p, profstage_t stage);
+void profGpuBegin(prof_t *p);
+void profGpuEnd(prof_t *p);
+void profSummary(const prof_t *p, profsummary_t *s);
+// all frames in the ring, oldest first, as json if path ends in .json, else csv
+bool profDump(const prof_t *p, const char *path);
+
+// time the statement or block after it
+#define PROF_SCOPE(p, stage) \
+    for (int s_ = (profBegin(p, stage), 0); !s_; s_ = (profEnd(p, stage), 1))
@@ -0,0 +1,99 @@
+#include <string.h>
+#include "bsp.h"
+
+// kd-restart on the render nodes: descend with the part [tmin, tmax] of the
+// ray that is left, shorten tmax at every node it crosses and go to the
+// near side only; at a leaf that does not stop it, the ray moves on to
+// tmax and starts down again. the restart node is the deepest one that
+// holds all of [tmin, 1] on one side, so no stack is needed and a query is
+// a few words of state, any number of them can run side by side
+
+static inline bool stops(int32_t contents) {
+    return contents == CONTENTS_SOLID || contents == CONTENTS_SKY;
+}
+
+void rayCast(ZigLoadBSP *bsp, vec3 start, vec3 end, rayhit_t *hit) {
+    memset(hit, 0, sizeof(*hit));
+    vec3 dir;
+    glm_vec3_sub(end, start, dir);
+    float tmin = 0.0f;
+    int32_t restart = bsp->headnode;
+    plane_t entry = {0}; // plane the ray entered the current part through
+    while (true) {
+        float tmax = 1.0f;
+        plane_t exit = {0};
+        bool pushdown = true;
+        int32_t node = restart;
+        while (node >= 0) {
+            node_t *n = bsp->nodes + node;
+            plane_t *p = bsp->planes + n->iPlane;
+            float d0 = glm_vec3_dot(p->n, start) - p->d;
+            float dd = glm_vec3_dot(p->n, dir);
+            // sides as in findLeaf, on the plane is back
+            int s0 = d0 + dd * tmin <= 0.0f;
+            int s1 = d0 + dd * tmax <= 0.0f;
+            if (s0 != s1) {
+                // the crossing decides, so a ray that restarts on a plane goes past it
+                float t = -d0 / dd;
+                if (t <= tmin)
+                    s0 = s1;
+                else if (t >= tmax)
+                    s1 = s0;
+                else {
+                    tmax = t;
+                    pushdown = false;
+                    // facing the side the ray comes from
+                    glm_vec3_copy(p->n, exit.n);
+                    exit.d = p->d;
+                    exit.type = p->type;
+                    if (s0) {
+                        glm_vec3_negate(exit.n);
+                        exit.d = -p->d;
+                    }
+                }
+            }
+            node = n->iChilds[s0];
+            if (pushdown && node >= 0)
+                restart = node;
+        }
+        int32_t leaf = ~node;
+        int32_t contents = bsp->leaves[leaf].contents;
+        if (stops(contents)) {
+            hit->fraction = tmin;
+            hit->contents = contents;
+            hit->leaf = leaf;
+            hit->plane = entry;
+            hit->startsolid = tmin == 0.0f;
+            glm_vec3_copy(start, hit->endpos);
+            glm_vec3_muladds(dir, tmin, hit->endpos);
+            return;
+        }
+        if (tmax >= 1.0f) {
+            hit->fraction = 1.0f;
+            hit->contents = contents;
+            hit->leaf = leaf;
+            glm_vec3_copy(end, hit->endpos);
+            return;
+        }
+        tmin = tmax;
+        entry = exit;
+    }
+}
+
+typedef struct {
+    ZigLoadBSP *bsp;
+    const rayquery_t *queries;
+    rayhit_t *hits;
+} raybatch_t;
+
+static void rayChunk(void *ctx, size_t begin, size_t end) {
+    raybatch_t *b = ctx;
+    for (size_t i = begin; i < end; i++) {
+        rayCast(b->bsp, (float *)b->queries[i].start, (float *)b->queries[i].end, b->hits + i);
+    }
+}
+
+void rayCastBatch(pool_t *pool, ZigLoadBSP *bsp, const rayquery_t *queries, rayhit_t *hits, size_t count) {
+    raybatch_t b = {bsp, queries, hits};
+    poolFor(pool, count, 256, rayChunk, &b);
+}
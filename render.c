@@ -0,0 +1,625 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "render.h"
+#include "shader.h"
+
+static bool faceDrawable(ZigLoadBSP *bsp, uint32_t f) {
+    facedraw_t fd = bsp->facedraw[f];
+    return fd.n3Indexs > 0 && !bsp->textures[fd.iTexture].skipped;
+}
+
+static void linkParents(ZigLoadBSP *bsp, drawlist_t *dl, int32_t node, int32_t parent) {
+    if (node < 0) {
+        dl->leafParent[~node] = parent;
+        return;
+    }
+    dl->nodeParent[node] = parent;
+    linkParents(bsp, dl, bsp->nodes[node].iChilds[0], node);
+    linkParents(bsp, dl, bsp->nodes[node].iChilds[1], node);
+}
+
+static void drawlistInit(ZigLoadBSP *bsp, drawlist_t *dl) {
+    memset(dl, 0, sizeof(*dl));
+    dl->faceFrame = calloc(bsp->face_cnt, sizeof(uint32_t));
+    dl->nodeVis = calloc(bsp->nodecnt, sizeof(uint32_t));
+    dl->leafVis = calloc(bsp->leafcnt, sizeof(uint32_t));
+    dl->nodeParent = malloc(sizeof(int32_t) * bsp->nodecnt);
+    dl->leafParent = malloc(sizeof(int32_t) * bsp->leafcnt);
+    dl->vis = malloc((bsp->visleafs + 7) >> 3);
+    dl->texBase = calloc(bsp->text_cnt, sizeof(uint32_t));
+    dl->texUsed = calloc(bsp->text_cnt, sizeof(uint32_t));
+    dl->texOrder = malloc(sizeof(uint32_t) * (bsp->text_cnt + 1));
+    linkParents(bsp, dl, bsp->headnode, -1);
+    dl->modelDraw = calloc(bsp->model_cnt, sizeof(uint32_t));
+    // one slot per face is enough, even if nothing gets merged, and a
+    // brush model range has at least one face
+    for (uint32_t f = 0; f < bsp->face_cnt; f++)
+        if (faceDrawable(bsp, f)) {
+            dl->texUsed[bsp->facedraw[f].iTexture]++;
+            dl->nDraw++;
+        }
+    for (uint32_t m = 1; m < bsp->model_cnt; m++) {
+        ZigBSPModel *mdl = bsp->models + m;
+        for (uint32_t f = mdl->iFace0; f < mdl->iFace0 + mdl->nFaces; f++)
+            dl->modelDraw[m] += faceDrawable(bsp, f);
+    }
+    uint32_t nSlots = 0;
+    for (uint32_t t = 0; t < bsp->text_cnt; t++) {
+        dl->texBase[t] = nSlots;
+        nSlots += dl->texUsed[t];
+    }
+    dl->counts = malloc(sizeof(GLsizei) * (nSlots + 1));
+    dl->offsets = malloc(sizeof(void *) * (nSlots + 1));
+    dl->bases = malloc(sizeof(GLint) * (nSlots + 1));
+    for (uint32_t t = 0; t < bsp->text_cnt; t++) {
+        for (uint32_t k = dl->texBase[t]; k < dl->texBase[t] + dl->texUsed[t]; k++)
+            dl->bases[k] = bsp->textures[t].iVertex0;
+        dl->texUsed[t] = 0;
+    }
+    dl->leaf = -1;
+    dl->frustum = true;
+    dl->models = true;
+}
+
+static void drawlistFree(drawlist_t *dl) {
+    free(dl->faceFrame);
+    free(dl->nodeVis);
+    free(dl->leafVis);
+    free(dl->nodeParent);
+    free(dl->leafParent);
+    free(dl->vis);
+    free(dl->counts);
+    free(dl->offsets);
+    free(dl->bases);
+    free(dl->texBase);
+    free(dl->texUsed);
+    free(dl->texOrder);
+    free(dl->modelDraw);
+}
+
+// mark leaves in the PVS of leaf, and all their parents
+static void drawlistSetLeaf(ZigLoadBSP *bsp, drawlist_t *dl, int32_t leaf) {
+    dl->leaf = leaf;
+    dl->visframe++;
+    dl->frame++;
+    dl->nPVS = 0;
+    decompressVis(bsp, leaf, dl->vis);
+    for (size_t i = 0; i < bsp->visleafs && i + 1 < bsp->leafcnt; i++) {
+        if (!(dl->vis[i >> 3] & (1 << (i & 7))))
+            continue;
+        leaf_t *l = bsp->leaves + i + 1;
+        for (uint32_t m = 0; m < l->nMarkSurfaces; m++) {
+            uint32_t f = bsp->marksurf[l->iMarkSurface0 + m];
+            if (dl->faceFrame[f] != dl->frame && faceDrawable(bsp, f)) {
+                dl->faceFrame[f] = dl->frame;
+                dl->nPVS++;
+            }
+        }
+        dl->leafVis[i + 1] = dl->visframe;
+        for (int32_t n = dl->leafParent[i + 1]; n >= 0 && dl->nodeVis[n] != dl->visframe; n = dl->nodeParent[n])
+            dl->nodeVis[n] = dl->visframe;
+    }
+    for (uint32_t f = bsp->world_nf; f < bsp->face_cnt; f++)
+        dl->nPVS += faceDrawable(bsp, f);
+}
+
+// add an index range of a face or a brush model
+static void drawlistAddRange(ZigLoadBSP *bsp, drawlist_t *dl, facedraw_t fd) {
+    uint32_t base = dl->texBase[fd.iTexture];
+    uint32_t used = dl->texUsed[fd.iTexture];
+    size_t start = bsp->idx_size * 3 * (size_t)fd.i3Index0;
+    if (used > 0) {
+        // merge with previous range if continuous in the EBO
+        uint32_t k = base + used - 1;
+        if ((uintptr_t)dl->offsets[k] + bsp->idx_size * dl->counts[k] == start) {
+            dl->counts[k] += fd.n3Indexs * 3;
+            return;
+        }
+    }
+    if (used == 0)
+        dl->texOrder[dl->nTexOrder++] = fd.iTexture;
+    dl->counts[base + used] = fd.n3Indexs * 3;
+    dl->offsets[base + used] = (const void *)start;
+    dl->texUsed[fd.iTexture] = used + 1;
+}
+
+static void drawlistAdd(ZigLoadBSP *bsp, drawlist_t *dl, uint32_t f) {
+    if (!faceDrawable(bsp, f))
+        return;
+    dl->nVis++;
+    drawlistAddRange(bsp, dl, bsp->facedraw[f]);
+}
+
+// returns false if the box is outside, clears bits of planes it is fully inside
+static bool boxInFrustum(vec4 *planes, int16_t mins[3], int16_t maxs[3], uint32_t *clip) {
+    for (int i = 0; i < 6; i++) {
+        if (!(*clip & (1 << i)))
+            continue;
+        float *p = planes[i];
+        float dmax = p[3], dmin = p[3];
+        for (int k = 0; k < 3; k++) {
+            float lo = p[k] * mins[k], hi = p[k] * maxs[k];
+            dmax += GLM_MAX(lo, hi);
+            dmin += GLM_MIN(lo, hi);
+        }
+        if (dmax < 0.0f)
+            return false;
+        if (dmin >= 0.0f)
+            *clip &= ~(1 << i);
+    }
+    return true;
+}
+
+// faces of the node marked in this frame, added ones are marked ~frame,
+// which leaves do not overwrite
+static void drawlistNodeFaces(ZigLoadBSP *bsp, drawlist_t *dl, node_t *n) {
+    for (uint32_t f = n->iFace0; f < (uint32_t)n->iFace0 + n->nFaces; f++)
+        if (dl->faceFrame[f] == dl->frame) {
+            dl->faceFrame[f] = ~dl->frame;
+            drawlistAdd(bsp, dl, f);
+        }
+}
+
+static void drawlistWalk(ZigLoadBSP *bsp, drawlist_t *dl, int32_t node, vec4 *planes, uint32_t clip, vec3 eye) {
+    if (node < 0) {
+        leaf_t *l = bsp->leaves + ~node;
+        if (dl->leafVis[~node] != dl->visframe)
+            return;
+        dl->nNodes++;
+        if (clip && !boxInFrustum(planes, l->mins, l->maxs, &clip)) {
+            dl->nReject++;
+            return;
+        }
+        for (uint32_t m = 0; m < l->nMarkSurfaces; m++) {
+            uint32_t f = bsp->marksurf[l->iMarkSurface0 + m];
+            if (dl->faceFrame[f] != ~dl->frame)
+                dl->faceFrame[f] = dl->frame;
+        }
+        return;
+    }
+    node_t *n = bsp->nodes + node;
+    if (dl->nodeVis[node] != dl->visframe)
+        return;
+    dl->nNodes++;
+    if (clip && !boxInFrustum(planes, n->mins, n->maxs, &clip)) {
+        dl->nReject++;
+        return;
+    }
+    // near side first, so the list is roughly front to back; faces on a
+    // node are only referenced by leaves below it, those facing the eye by
+    // leaves on the near side, the others are added after the far side
+    plane_t *p = bsp->planes + n->iPlane;
+    int near = glm_vec3_dot(p->n, eye) - p->d < 0.0f;
+    drawlistWalk(bsp, dl, n->iChilds[near], planes, clip, eye);
+    drawlistNodeFaces(bsp, dl, n);
+    drawlistWalk(bsp, dl, n->iChilds[!near], planes, clip, eye);
+    drawlistNodeFaces(bsp, dl, n);
+}
+
+// rebuild list of faces in the PVS, and in the frustum if planes is not
+// NULL, in node order from eye
+static void drawlistBuild(ZigLoadBSP *bsp, drawlist_t *dl, vec4 *planes, vec3 eye) {
+    dl->frame++;
+    dl->nVis = 0;
+    dl->nNodes = 0;
+    dl->nReject = 0;
+    dl->nModels = 0;
+    dl->nTexOrder = 0;
+    memset(dl->texUsed, 0, sizeof(uint32_t) * bsp->text_cnt);
+    drawlistWalk(bsp, dl, bsp->headnode, planes, planes ? 0x3F : 0, eye);
+    // brush models are not in any leaf, cull them by their own bounds
+    for (uint32_t m = 1; m < bsp->model_cnt && dl->models; m++) {
+        ZigBSPModel *mdl = bsp->models + m;
+        uint32_t clip = 0x3F;
+        if (dl->modelDraw[m] == 0 || (planes && !boxInFrustum(planes, mdl->mins, mdl->maxs, &clip)))
+            continue;
+        dl->nModels++;
+        dl->nVis += dl->modelDraw[m];
+        for (uint32_t r = mdl->iRange0; r < mdl->iRange0 + mdl->nRanges; r++)
+            if (!bsp->textures[bsp->ranges[r].iTexture].skipped)
+                drawlistAddRange(bsp, dl, bsp->ranges[r]);
+    }
+}
+
+static const attrib_t attribs[] = {
+    {ATTR_POS, "vtxPos"},
+    {ATTR_TEX, "texPos"},
+    {ATTR_LAYER, "texLayer"},
+    {ATTR_INDEX, "texIndex"},
+    {ATTR_LIGHT, "lmPos"},
+};
+
+static void setTexParams(GLenum target) {
+    glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, 3);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+}
+
+// rgba, or palette indices for TEX_INDEX
+static GLenum texFormat(ZigLoadBSP *bsp) {
+    return bsp->tex_fmt == TEX_INDEX ? GL_RED : GL_RGBA;
+}
+
+static GLint texInternal(GLenum format) {
+    return format == GL_RED ? GL_R8 : GL_RGBA8;
+}
+
+static size_t texelSize(GLenum format) {
+    return format == GL_RED ? 1 : 4;
+}
+
+static const uint8_t *texData(ZigBSPTex *t, GLenum format) {
+    return format == GL_RED ? t->indexs : (const uint8_t *)t->pixels;
+}
+
+// one GL_TEXTURE_2D per texture, texels are queued on st
+static GLuint *uploadTextures(ZigLoadBSP *bsp, stream_t *st, size_t *bytes) {
+    GLenum format = texFormat(bsp);
+    GLuint *texObjs = malloc(sizeof(GLuint) * bsp->text_cnt);
+    glGenTextures(bsp->text_cnt, texObjs);
+    for (uint32_t i = 0; i < bsp->text_cnt; i++) {
+        ZigBSPTex bsptex = bsp->textures[i];
+        glBindTexture(GL_TEXTURE_2D, texObjs[i]);
+        // the bsp has 4 mip levels already
+        const uint8_t *data = texData(&bsptex, format);
+        for (int l = 0; l < 4; l++) {
+            uint32_t w = bsptex.width >> l, h = bsptex.height >> l;
+            glTexImage2D(GL_TEXTURE_2D, l, texInternal(format), w, h, 0, format, GL_UNSIGNED_BYTE, NULL);
+            *bytes += (size_t)w * h * texelSize(format);
+            if (data) {
+                streamTex2D(st, texObjs[i], l, w, h, format, data);
+                data += (size_t)w * h * texelSize(format);
+            }
+        }
+        setTexParams(GL_TEXTURE_2D);
+    }
+    return texObjs;
+}
+
+// one GL_TEXTURE_2D_ARRAY per ZigBSPTexArr, texels are queued on st
+static GLuint *uploadTexArrays(ZigLoadBSP *bsp, stream_t *st, size_t *bytes) {
+    GLenum format = texFormat(bsp);
+    GLuint *arrObjs = malloc(sizeof(GLuint) * bsp->tarr_cnt);
+    glGenTextures(bsp->tarr_cnt, arrObjs);
+    for (uint32_t a = 0; a < bsp->tarr_cnt; a++) {
+        ZigBSPTexArr arr = bsp->texarrs[a];
+        glBindTexture(GL_TEXTURE_2D_ARRAY, arrObjs[a]);
+        for (int l = 0; l < 4; l++) {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, l, texInternal(format), arr.width >> l, arr.height >> l, arr.layers, 0, format, GL_UNSIGNED_BYTE, NULL);
+            *bytes += (size_t)(arr.width >> l) * (arr.height >> l) * arr.layers * texelSize(format);
+        }
+        setTexParams(GL_TEXTURE_2D_ARRAY);
+    }
+    for (uint32_t i = 0; i < bsp->text_cnt; i++) {
+        ZigBSPTex bsptex = bsp->textures[i];
+        const uint8_t *data = texData(&bsptex, format);
+        if (!data)
+            continue;
+        for (int l = 0; l < 4; l++) {
+            uint32_t w = bsptex.width >> l, h = bsptex.height >> l;
+            streamTexLayer(st, arrObjs[bsptex.texarr], l, bsptex.layer, w, h, format, data);
+            data += (size_t)w * h * texelSize(format);
+        }
+    }
+    return arrObjs;
+}
+
+// the palettes of TEX_INDEX as the rows of one texture, row t for texture t
+static GLuint uploadPalettes(ZigLoadBSP *bsp, stream_t *st, size_t *bytes) {
+    GLuint palTex;
+    glGenTextures(1, &palTex);
+    glBindTexture(GL_TEXTURE_2D, palTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, bsp->pal_cnt, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    streamTex2D(st, palTex, 0, 256, bsp->pal_cnt, GL_RGBA, bsp->palettes);
+    *bytes += sizeof(*bsp->palettes) * bsp->pal_cnt;
+    return palTex;
+}
+
+// one rgb texture, filtered, the coordinates are at luxel centers
+// an atlas larger than the driver takes becomes one white luxel, the map
+// is drawn unlit instead of black
+static GLuint uploadLightmap(ZigLoadBSP *bsp, stream_t *st, size_t *bytes) {
+    static const uint8_t white[3] = {255, 255, 255};
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    uint32_t width = bsp->lm_width, height = bsp->lm_height;
+    const void *pixels = bsp->lightmap;
+    if (width > (uint32_t)maxSize || height > (uint32_t)maxSize) {
+        fprintf(stderr, "lightmap %ux%u is over GL_MAX_TEXTURE_SIZE %d, drawn unlit\n", width, height, maxSize);
+        width = height = 1;
+        pixels = white;
+    }
+    GLuint lightTex;
+    glGenTextures(1, &lightTex);
+    glBindTexture(GL_TEXTURE_2D, lightTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    streamTex2D(st, lightTex, 0, width, height, GL_RGB, pixels);
+    *bytes += 3 * (size_t)width * height;
+    return lightTex;
+}
+
+static GLenum indexType(ZigLoadBSP *bsp) {
+    return bsp->idx_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+// attributes of ZigLoadBSP.vtx_fmt, for the bound GL_ARRAY_BUFFER
+static void setVertexFormat(uint8_t fmt) {
+    glEnableVertexAttribArray(ATTR_POS);
+    glEnableVertexAttribArray(ATTR_TEX);
+    glEnableVertexAttribArray(ATTR_LIGHT);
+    if (fmt == VTX_QUANT) {
+        glVertexAttribPointer(ATTR_POS, 3, GL_SHORT, GL_FALSE, sizeof(vertexq_t), (void *)offsetof(vertexq_t, pos));
+        glVertexAttribPointer(ATTR_TEX, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(vertexq_t), (void *)offsetof(vertexq_t, tex));
+        glVertexAttribPointer(ATTR_LIGHT, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(vertexq_t), (void *)offsetof(vertexq_t, lm));
+    } else {
+        glVertexAttribPointer(ATTR_POS, 3, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (void *)offsetof(vertex_t, pos));
+        glVertexAttribPointer(ATTR_TEX, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (void *)offsetof(vertex_t, tex));
+        glVertexAttribPointer(ATTR_LIGHT, 2, GL_FLOAT, GL_FALSE, sizeof(vertex_t), (void *)offsetof(vertex_t, lm));
+    }
+}
+
+static void mdiInit(ZigLoadBSP *bsp, drawlist_t *dl, mdi_t *mdi) {
+    memset(mdi, 0, sizeof(*mdi));
+    mdi->cmds = malloc(sizeof(drawcmd_t) * (dl->nDraw + 1));
+    mdi->arrRank = malloc(sizeof(uint32_t) * (bsp->tarr_cnt + 1));
+    mdi->rankArr = malloc(sizeof(uint32_t) * (bsp->tarr_cnt + 1));
+    mdi->runFirst = malloc(sizeof(uint32_t) * (2 * bsp->tarr_cnt + 1));
+    mdi->runFill = malloc(sizeof(uint32_t) * (2 * bsp->tarr_cnt + 1));
+    // layer and texture index of each texture, the instance is the texture
+    float(*layers)[2] = malloc(sizeof(float[2]) * (bsp->text_cnt + 1));
+    for (uint32_t i = 0; i < bsp->text_cnt; i++) {
+        layers[i][0] = bsp->textures[i].layer;
+        layers[i][1] = i;
+    }
+    glGenBuffers(1, &mdi->cmdBuf);
+    glGenBuffers(1, &mdi->layerBuf);
+    glBindBuffer(GL_ARRAY_BUFFER, mdi->layerBuf);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float[2]) * (bsp->text_cnt + 1), layers, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ATTR_LAYER);
+    glVertexAttribPointer(ATTR_LAYER, 1, GL_FLOAT, GL_FALSE, sizeof(float[2]), NULL);
+    glVertexAttribDivisor(ATTR_LAYER, 1);
+    glEnableVertexAttribArray(ATTR_INDEX);
+    glVertexAttribPointer(ATTR_INDEX, 1, GL_FLOAT, GL_FALSE, sizeof(float[2]), (void *)sizeof(float));
+    glVertexAttribDivisor(ATTR_INDEX, 1);
+    free(layers);
+}
+
+static void mdiFree(mdi_t *mdi) {
+    glDeleteBuffers(1, &mdi->cmdBuf);
+    glDeleteBuffers(1, &mdi->layerBuf);
+    free(mdi->cmds);
+    free(mdi->arrRank);
+    free(mdi->rankArr);
+    free(mdi->runFirst);
+    free(mdi->runFill);
+}
+
+// commands of both passes, opaque first, grouped by array; arrays come in
+// the order the list first uses them and textures in list order, so a
+// pass is still roughly front to back with one multi-draw per array
+static void mdiBuild(ZigLoadBSP *bsp, drawlist_t *dl, mdi_t *mdi) {
+    uint32_t nArr = bsp->tarr_cnt;
+    for (uint32_t a = 0; a < nArr; a++)
+        mdi->arrRank[a] = UINT32_MAX;
+    mdi->nRanks = 0;
+    memset(mdi->runFirst, 0, sizeof(uint32_t) * (2 * nArr + 1));
+    for (uint32_t o = 0; o < dl->nTexOrder; o++) {
+        uint32_t t = dl->texOrder[o];
+        ZigBSPTex *tex = bsp->textures + t;
+        if (mdi->arrRank[tex->texarr] == UINT32_MAX) {
+            mdi->rankArr[mdi->nRanks] = tex->texarr;
+            mdi->arrRank[tex->texarr] = mdi->nRanks++;
+        }
+        mdi->runFirst[(tex->alpha ? nArr : 0) + mdi->arrRank[tex->texarr] + 1] += dl->texUsed[t];
+    }
+    for (uint32_t k = 0; k < 2 * nArr; k++)
+        mdi->runFirst[k + 1] += mdi->runFirst[k];
+    memcpy(mdi->runFill, mdi->runFirst, sizeof(uint32_t) * 2 * nArr);
+    for (uint32_t o = 0; o < dl->nTexOrder; o++) {
+        uint32_t t = dl->texOrder[o];
+        ZigBSPTex *tex = bsp->textures + t;
+        uint32_t *fill = mdi->runFill + (tex->alpha ? nArr : 0) + mdi->arrRank[tex->texarr];
+        for (uint32_t k = dl->texBase[t]; k < dl->texBase[t] + dl->texUsed[t]; k++)
+            mdi->cmds[(*fill)++] = (drawcmd_t){
+                .count = dl->counts[k],
+                .instanceCount = 1,
+                .firstIndex = (uintptr_t)dl->offsets[k] / bsp->idx_size,
+                .baseVertex = dl->bases[k],
+                .baseInstance = t,
+            };
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mdi->cmdBuf);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(drawcmd_t) * mdi->runFirst[2 * nArr], mdi->cmds, GL_STREAM_DRAW);
+}
+
+// the commands of one pass from mdiBuild
+static void mdiDraw(ZigLoadBSP *bsp, mdi_t *mdi, GLuint *arrObjs, bool alpha, profframe_t *pf) {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mdi->cmdBuf);
+    for (uint32_t r = 0; r < mdi->nRanks; r++) {
+        uint32_t run = (alpha ? bsp->tarr_cnt : 0) + r;
+        GLsizei count = mdi->runFirst[run + 1] - mdi->runFirst[run];
+        if (count == 0)
+            continue;
+        for (uint32_t c = mdi->runFirst[run]; c < mdi->runFirst[run + 1]; c++)
+            pf->tris += mdi->cmds[c].count / 3;
+        glBindTexture(GL_TEXTURE_2D_ARRAY, arrObjs[mdi->rankArr[r]]);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, indexType(bsp), (void *)(sizeof(drawcmd_t) * mdi->runFirst[run]), count, 0);
+        pf->binds++;
+        pf->draws++;
+    }
+}
+
+// one draw per texture of the pass, in list order; the texture index
+// goes to the shader as the constant value of ATTR_INDEX
+static void texDraw(ZigLoadBSP *bsp, drawlist_t *dl, GLuint *texObjs, bool alpha, profframe_t *pf) {
+    for (uint32_t o = 0; o < dl->nTexOrder; o++) {
+        uint32_t i = dl->texOrder[o];
+        if (bsp->textures[i].alpha != alpha)
+            continue;
+        glBindTexture(GL_TEXTURE_2D, texObjs[i]);
+        glVertexAttrib1f(ATTR_INDEX, i);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, dl->counts + dl->texBase[i], indexType(bsp),
+                                      dl->offsets + dl->texBase[i], dl->texUsed[i], dl->bases + dl->texBase[i]);
+        for (uint32_t k = dl->texBase[i]; k < dl->texBase[i] + dl->texUsed[i]; k++)
+            pf->tris += dl->counts[k] / 3;
+        pf->binds++;
+        pf->draws++;
+    }
+}
+
+void mapCreate(map_t *m, stream_t *st, bool mdiCaps) {
+    ZigLoadBSP *bsp = &m->bsp;
+    glGenVertexArrays(1, &m->vao);
+    glGenBuffers(1, &m->vbo);
+    glGenBuffers(1, &m->ebo);
+    glBindVertexArray(m->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+    glBufferData(GL_ARRAY_BUFFER, bsp->vbo_size, NULL, GL_STATIC_DRAW);
+    setVertexFormat(bsp->vtx_fmt);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m->ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, bsp->ebo_size, NULL, GL_STATIC_DRAW);
+    streamBuffer(st, m->vbo, bsp->vbo_data, bsp->vbo_size);
+    streamBuffer(st, m->ebo, bsp->ebo_data, bsp->ebo_size);
+    // texture arrays and multi-draw indirect, or one draw per texture
+    m->useMDI = mdiCaps && bsp->tarr_cnt > 0;
+    m->texBytes = 0;
+    if (m->useMDI)
+        m->texObjs = uploadTexArrays(bsp, st, &m->texBytes);
+    else
+        m->texObjs = uploadTextures(bsp, st, &m->texBytes);
+    // indices, looked up in their palette row by the fragment shader
+    m->paletted = bsp->tex_fmt == TEX_INDEX && bsp->pal_cnt > 0;
+    if (m->paletted)
+        m->palTex = uploadPalettes(bsp, st, &m->texBytes);
+    // every face samples the one atlas, no draw calls or binds per face
+    m->lightTex = uploadLightmap(bsp, st, &m->texBytes);
+    fprintf(stderr, "render path: %s\n", m->useMDI ? "texture arrays, multi-draw indirect" : "texture per draw");
+    fprintf(stderr, "textures: %s, lightmap %ux%u, %zu bytes on the gpu\n", m->paletted ? "palette indices" : "rgba",
+            bsp->lm_width, bsp->lm_height, m->texBytes);
+    fprintf(stderr, "loaded: vertices: %zu indices: %zu textures: %zu\n",
+            bsp->vbo_size / (bsp->vtx_fmt == VTX_QUANT ? sizeof(vertexq_t) : sizeof(vertex_t)), bsp->ebo_size / bsp->idx_size, bsp->text_cnt);
+    fprintf(stderr, "clipnodes: %zu, planes: %zu, mapped: %zu bytes\n", bsp->clip_cnt, bsp->planecnt, bsp->map_size);
+    fprintf(stderr, "nodes: %zu, leaves: %zu, faces: %zu\n", bsp->nodecnt, bsp->leafcnt, bsp->face_cnt);
+    drawlistInit(bsp, &m->dl);
+    if (m->useMDI)
+        mdiInit(bsp, &m->dl, &m->mdi);
+    m->posScale = bsp->pos_scale;
+}
+
+void mapFree(map_t *m) {
+    if (m->useMDI)
+        mdiFree(&m->mdi);
+    glDeleteTextures(m->useMDI ? m->bsp.tarr_cnt : m->bsp.text_cnt, m->texObjs);
+    if (m->paletted)
+        glDeleteTextures(1, &m->palTex);
+    glDeleteTextures(1, &m->lightTex);
+    free(m->texObjs);
+    drawlistFree(&m->dl);
+    glDeleteBuffers(1, &m->vbo);
+    glDeleteBuffers(1, &m->ebo);
+    glDeleteVertexArrays(1, &m->vao);
+    PM_GridDetach(&m->bsp);
+    zigFreeBSP(&m->bsp);
+}
+
+bool rendererInit(renderer_t *r) {
+    memset(r, 0, sizeof(*r));
+    for (int i = 0; i < 2; i++)
+        for (int p = 0; p < 2; p++)
+            for (int a = 0; a < 2; a++) {
+                char defines[128];
+                snprintf(defines, sizeof(defines), "%s%s%s", i ? "#define TEXARRAY\n" : "",
+                         p ? "#define PALETTE\n" : "", a ? "#define ALPHATEST\n" : "");
+                GLuint prog = programLoad(defines, attribs, sizeof(attribs) / sizeof(attribs[0]));
+                if (!prog) {
+                    rendererFree(r);
+                    return false;
+                }
+                r->progs[i][p][a] = prog;
+                glUseProgram(prog);
+                r->locMVPs[i][p][a] = glGetUniformLocation(prog, "mvp");
+                glUniform1i(glGetUniformLocation(prog, "tex"), 0); // GL_TEXTURE0
+                glUniform1i(glGetUniformLocation(prog, "pal"), 1); // GL_TEXTURE1
+                glUniform1i(glGetUniformLocation(prog, "lightmap"), 2); // GL_TEXTURE2
+            }
+    r->mdiCaps = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+
+    glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glEnable(GL_CULL_FACE);
+    glCullFace(GL_BACK);
+    // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    glActiveTexture(GL_TEXTURE0);
+    return true;
+}
+
+void rendererFree(renderer_t *r) {
+    for (int i = 0; i < 2; i++)
+        for (int p = 0; p < 2; p++)
+            for (int a = 0; a < 2; a++)
+                glDeleteProgram(r->progs[i][p][a]);
+    memset(r, 0, sizeof(*r));
+}
+
+static void drawPass(renderer_t *r, map_t *m, mat4 draw, bool alpha, profframe_t *pf) {
+    glUseProgram(r->progs[m->useMDI][m->paletted][alpha]);
+    glUniformMatrix4fv(r->locMVPs[m->useMDI][m->paletted][alpha], 1, GL_FALSE, &draw[0][0]);
+    if (m->useMDI)
+        mdiDraw(&m->bsp, &m->mdi, m->texObjs, alpha, pf);
+    else
+        texDraw(&m->bsp, &m->dl, m->texObjs, alpha, pf);
+}
+
+void mapDraw(renderer_t *r, map_t *m, mat4 mvp, vec3 eye, prof_t *prof) {
+    ZigLoadBSP *bsp = &m->bsp;
+    drawlist_t *dl = &m->dl;
+    mat4 m_draw;
+    glBindVertexArray(m->vao);
+    glm_scale_to(mvp, (vec3){m->posScale, m->posScale, m->posScale}, m_draw);
+    profBegin(prof, PROF_CULL);
+    int32_t leaf = findLeaf(bsp, eye);
+    bool leafChanged = leaf != dl->leaf;
+    if (leafChanged)
+        drawlistSetLeaf(bsp, dl, leaf);
+    if (dl->frustum) {
+        vec4 planes[6];
+        glm_frustum_planes(mvp, planes);
+        drawlistBuild(bsp, dl, planes, eye);
+    } else if (leafChanged || dl->nReject > 0)
+        drawlistBuild(bsp, dl, NULL, eye);
+    profEnd(prof, PROF_CULL);
+    profBegin(prof, PROF_DRAW);
+    if (m->paletted) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, m->palTex);
+    }
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, m->lightTex);
+    glActiveTexture(GL_TEXTURE0);
+    if (m->useMDI)
+        mdiBuild(bsp, dl, &m->mdi);
+    if (r->prepass) {
+        // the same program as the opaque pass, so depths match exactly
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        drawPass(r, m, m_draw, false, prof->cur);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_LEQUAL);
+    }
+    drawPass(r, m, m_draw, false, prof->cur);
+    drawPass(r, m, m_draw, true, prof->cur);
+    if (r->prepass)
+        glDepthFunc(GL_LESS);
+    profEnd(prof, PROF_DRAW);
+}
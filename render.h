@@ -0,0 +1,104 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <GL/glew.h>
+#include <cglm/cglm.h>
+#include "bsp.h"
+#include "prof.h"
+#include "mapload.h"
+
+// the world renderer: PVS and frustum culled drawlists, drawn with texture
+// arrays and multi-draw indirect or with one draw per texture
+
+// fixed attribute locations, shared by all programs
+#define ATTR_POS 0
+#define ATTR_TEX 1
+#define ATTR_LAYER 2
+#define ATTR_INDEX 3 // texture, the palette row of TEX_INDEX
+#define ATTR_LIGHT 4 // lightmap atlas coordinates
+
+typedef struct {
+    uint32_t frame;      // bumped per list build
+    uint32_t visframe;   // bumped per view leaf change
+    uint32_t *faceFrame; // frame in which the face was last marked
+    uint32_t *nodeVis;   // visframe in which a leaf below the node was in the PVS
+    uint32_t *leafVis;
+    int32_t *nodeParent;
+    int32_t *leafParent;
+    uint8_t *vis;    // decompressed PVS row
+    GLsizei *counts; // draw slots, texBase[t] .. texBase[t] + texUsed[t]
+    const void **offsets;
+    GLint *bases;    // base vertex of each slot, that of its texture
+    uint32_t *texBase;
+    uint32_t *texUsed;
+    uint32_t *texOrder; // textures of the list in the order first added, nTexOrder
+    uint32_t nTexOrder;
+    uint32_t *modelDraw; // drawable faces per model
+    int32_t leaf;    // current view leaf
+    bool frustum;    // enable frustum culling
+    bool models;     // draw brush models
+    uint32_t nDraw;  // drawable faces
+    uint32_t nPVS;   // faces in the PVS
+    uint32_t nVis;   // faces in the current list
+    uint32_t nNodes; // nodes and leaves visited
+    uint32_t nReject; // subtrees rejected by the frustum
+    uint32_t nModels; // brush models in the current list
+} drawlist_t;
+
+// multi-draw indirect: one command per range of the drawlist, baseInstance
+// is the texture index, which selects its layer through the instanced
+// texLayer attribute
+
+typedef struct {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+} drawcmd_t;
+
+typedef struct {
+    GLuint cmdBuf;
+    GLuint layerBuf;
+    drawcmd_t *cmds;
+    uint32_t *arrRank;  // per array, order in which the list first uses it
+    uint32_t *rankArr;  // array of each rank, nRanks
+    uint32_t *runFirst; // first command per pass and rank, 2 * tarr_cnt + 1 entries
+    uint32_t *runFill;
+    uint32_t nRanks;
+} mdi_t;
+
+// everything drawn for one map, the map on screen and the one streaming
+typedef struct {
+    ZigLoadBSP bsp;
+    GLuint vao, vbo, ebo;
+    GLuint *texObjs;
+    bool useMDI;
+    bool paletted; // GL_R8 palette indices, palTex holds the palettes
+    GLuint palTex;
+    GLuint lightTex; // the lightmap atlas, GL_TEXTURE2
+    size_t texBytes; // texture storage on the gpu
+    mdi_t mdi;
+    drawlist_t dl;
+    float posScale; // applied to mvp for quantized positions
+} map_t;
+
+// opaque textures are drawn first, roughly front to back, with a program
+// without discard so early depth testing works, alpha-tested ones after them
+typedef struct {
+    GLuint progs[2][2][2]; // by map_t.useMDI, map_t.paletted, then ZigBSPTex.alpha
+    GLint locMVPs[2][2][2];
+    bool mdiCaps; // multi-draw indirect with base instance
+    bool prepass; // depth of the opaque surfaces first, then shade each pixel once
+} renderer_t;
+
+// build the programs and set the GL state, false if a program does not build
+bool rendererInit(renderer_t *r);
+void rendererFree(renderer_t *r);
+
+// allocate the GL objects of m->bsp and queue their data on st
+void mapCreate(map_t *m, stream_t *st, bool mdiCaps);
+void mapFree(map_t *m);
+// cull m for a view from eye and draw it with the view projection mvp,
+// cpu stages and draw counts go to prof
+void mapDraw(renderer_t *r, map_t *m, mat4 mvp, vec3 eye, prof_t *prof);
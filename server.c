@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "server.h"
+#include "player.h"
+
+// own cache lines, agents moved by different threads never share one
+typedef struct {
+    _Alignas(64) player_t pl;
+    usercmd_t cmd;
+    uint64_t rng;
+    uint32_t hold; // ticks left with the same buttons
+} agent_t;
+
+typedef struct {
+    ZigLoadBSP *bsp;
+    agent_t *agents;
+    float dt;
+} step_t;
+
+static uint64_t xorshift(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static float randf(uint64_t *s) {
+    return (xorshift(s) >> 40) * (1.0f / (1 << 24));
+}
+
+// wander: turn a bit every tick, new buttons every few ticks
+static void botThink(agent_t *a) {
+    a->cmd.yaw += (randf(&a->rng) - 0.5f) * 10.0f;
+    if (a->cmd.yaw >= 180.0f)
+        a->cmd.yaw -= 360.0f;
+    if (a->cmd.yaw < -180.0f)
+        a->cmd.yaw += 360.0f;
+    if (a->hold > 0) {
+        a->hold--;
+        return;
+    }
+    static const uint16_t moves[] = {
+        BTN_FORWARD,
+        BTN_FORWARD | BTN_LEFT,
+        BTN_FORWARD | BTN_RIGHT,
+        BTN_FORWARD | BTN_JUMP,
+        BTN_FORWARD | BTN_DUCK,
+        BTN_BACK,
+        BTN_JUMP,
+        0,
+    };
+    a->cmd.buttons = moves[xorshift(&a->rng) % (sizeof(moves) / sizeof(moves[0]))];
+    a->hold = 10 + xorshift(&a->rng) % 50;
+}
+
+static void stepAgents(void *ctx, size_t begin, size_t end) {
+    step_t *st = ctx;
+    for (size_t i = begin; i < end; i++) {
+        agent_t *a = st->agents + i;
+        botThink(a);
+        player_move(st->bsp, &a->pl, &a->cmd, st->dt);
+    }
+}
+
+// random empty point of the player hull inside the world bounds
+static void spawnPoint(ZigLoadBSP *bsp, uint64_t *rng, vec3 pos) {
+    ZigBSPModel *world = bsp->models;
+    for (int tries = 0; tries < 1000; tries++) {
+        for (int k = 0; k < 3; k++)
+            pos[k] = world->mins[k] + randf(rng) * (world->maxs[k] - world->mins[k]);
+        if (PM_PointContents(bsp, 0, pos) == CONTENTS_EMPTY)
+            return;
+    }
+    glm_vec3_zero(pos);
+}
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int serverRun(ZigLoadBSP *bsp, int agents, int ticks, int threads, int tickrate) {
+    if (agents <= 0 || ticks <= 0 || tickrate <= 0 || bsp->model_cnt == 0) {
+        fprintf(stderr, "server: nothing to run\n");
+        return 1;
+    }
+    agent_t *as = aligned_alloc(_Alignof(agent_t), sizeof(agent_t) * agents);
+    if (!as) {
+        fprintf(stderr, "server: out of memory for %d agents\n", agents);
+        return 1;
+    }
+    memset(as, 0, sizeof(agent_t) * agents);
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    for (int i = 0; i < agents; i++) {
+        as[i].rng = xorshift(&seed) | 1;
+        spawnPoint(bsp, &as[i].rng, as[i].pl.pos);
+        as[i].cmd.yaw = randf(&as[i].rng) * 360.0f - 180.0f;
+    }
+
+    pool_t *pool = poolCreate(threads);
+    step_t st = {bsp, as, 1.0f / tickrate};
+    double start = now();
+    for (int t = 0; t < ticks; t++)
+        poolFor(pool, agents, 16, stepAgents, &st);
+    double secs = now() - start;
+
+    // the same for any thread count, each agent only depends on itself
+    uint64_t traces = 0;
+    uint32_t check = 0;
+    for (int i = 0; i < agents; i++) {
+        traces += as[i].pl.nTraces;
+        uint32_t bits[3];
+        memcpy(bits, as[i].pl.pos, sizeof(bits));
+        check = (check ^ bits[0] ^ bits[1] ^ bits[2]) * 16777619u;
+    }
+    printf("server: %d agents, %d ticks, %d threads: %.1f ticks/s (%.2fx realtime), %.0f agent-ticks/s, %.0f traces/s, check %08x\n",
+           agents, ticks, poolSize(pool), ticks / secs, ticks / secs / tickrate, (double)agents * ticks / secs, traces / secs, check);
+    poolDestroy(pool);
+    free(as);
+    return 0;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include "bsp.h"
+
+// headless server: agents driven by random bots, moved every tick on a
+// thread pool against the shared, read-only bsp; no window or GL
+int serverRun(ZigLoadBSP *bsp, int agents, int ticks, int threads, int tickrate);
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "shader.h"
+#include "shaders.h"
+
+#define CACHE_MAGIC 0x31475048u // "HPG1"
+#define PATH_SIZE 4096
+
+typedef struct {
+    uint32_t magic;
+    uint32_t format; // for glProgramBinary
+    uint32_t length;
+    uint32_t pad;
+    uint64_t key;
+} cachehdr_t;
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// with its terminator, so "ab" "c" and "a" "bc" differ
+static uint64_t hashStr(uint64_t h, const char *s) {
+    if (!s)
+        s = "";
+    return fnv1a(h, s, strlen(s) + 1);
+}
+
+static uint64_t programKey(const char *defines, const attrib_t *attribs, int nAttribs) {
+    const GLenum driver[] = {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION};
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < sizeof(driver) / sizeof(driver[0]); i++)
+        h = hashStr(h, (const char *)glGetString(driver[i]));
+    h = hashStr(h, vShaderSrc);
+    h = hashStr(h, fShaderSrc);
+    h = hashStr(h, defines);
+    for (int i = 0; i < nAttribs; i++) {
+        h = fnv1a(h, &attribs[i].index, sizeof(attribs[i].index));
+        h = hashStr(h, attribs[i].name);
+    }
+    return h;
+}
+
+// file of key in the cache directory, which is created if missing;
+// false without a place for it
+static bool cachePath(uint64_t key, char *path) {
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char dir[PATH_SIZE];
+    if (xdg && *xdg) {
+        snprintf(dir, sizeof(dir), "%s", xdg);
+    } else if (home && *home) {
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+        mkdir(dir, 0755);
+    } else {
+        return false;
+    }
+    size_t len = strlen(dir);
+    snprintf(dir + len, sizeof(dir) - len, "/hlbsp");
+    mkdir(dir, 0755);
+    return snprintf(path, PATH_SIZE, "%s/%016llx.prog", dir, (unsigned long long)key) < PATH_SIZE;
+}
+
+static GLuint loadCached(const char *path, uint64_t key) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return 0;
+    cachehdr_t hdr;
+    void *bin = NULL;
+    GLuint prog = 0;
+    if (fread(&hdr, sizeof(hdr), 1, fp) == 1 && hdr.magic == CACHE_MAGIC && hdr.key == key && hdr.length > 0 &&
+        (bin = malloc(hdr.length)) && fread(bin, hdr.length, 1, fp) == 1) {
+        prog = glCreateProgram();
+        glProgramBinary(prog, hdr.format, bin, hdr.length);
+        GLint ok = GL_FALSE;
+        glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+        if (!ok) {
+            glDeleteProgram(prog);
+            prog = 0;
+        }
+    }
+    free(bin);
+    fclose(fp);
+    return prog;
+}
+
+// through a temporary file, so a reader never sees half of it
+static void storeCached(const char *path, uint64_t key, GLuint prog) {
+    GLint length = 0;
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    void *bin = malloc(length);
+    GLsizei got = 0;
+    GLenum format = 0;
+    glGetProgramBinary(prog, length, &got, &format, bin);
+    cachehdr_t hdr = {CACHE_MAGIC, format, got, 0, key};
+    char tmp[PATH_SIZE + 4];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    bool ok = fp && got > 0 && fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && fwrite(bin, got, 1, fp) == 1;
+    if (fp && fclose(fp) != 0)
+        ok = false;
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "program cache not written: %s\n", path);
+        remove(tmp);
+    }
+    free(bin);
+}
+
+static GLuint compileShader(GLenum type, const char *defines, const char *src) {
+    GLuint sh = glCreateShader(type);
+    const GLchar *parts[] = {"#version 330 core\n", defines, src};
+    glShaderSource(sh, 3, parts, NULL);
+    glCompileShader(sh);
+    GLint ok = GL_FALSE;
+    glGetShaderiv(sh, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[4096];
+        glGetShaderInfoLog(sh, sizeof(log), NULL, log);
+        fprintf(stderr, "%s shader (%s): %s\n", type == GL_VERTEX_SHADER ? "vertex" : "fragment", defines, log);
+        glDeleteShader(sh);
+        return 0;
+    }
+    return sh;
+}
+
+static GLuint compileProgram(const char *defines, const attrib_t *attribs, int nAttribs, bool retrievable) {
+    GLuint vs = compileShader(GL_VERTEX_SHADER, defines, vShaderSrc);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, defines, fShaderSrc);
+    if (!vs || !fs) {
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        return 0;
+    }
+    GLuint prog = glCreateProgram();
+    glAttachShader(prog, vs);
+    glAttachShader(prog, fs);
+    for (int i = 0; i < nAttribs; i++)
+        glBindAttribLocation(prog, attribs[i].index, attribs[i].name);
+    if (retrievable)
+        glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(prog);
+    glDetachShader(prog, vs);
+    glDetachShader(prog, fs);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    GLint ok = GL_FALSE;
+    glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[4096];
+        glGetProgramInfoLog(prog, sizeof(log), NULL, log);
+        fprintf(stderr, "program (%s): %s\n", defines, log);
+        glDeleteProgram(prog);
+        return 0;
+    }
+    return prog;
+}
+
+GLuint programLoad(const char *defines, const attrib_t *attribs, int nAttribs) {
+    double start = now();
+    GLint formats = 0;
+    if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    uint64_t key = programKey(defines, attribs, nAttribs);
+    char path[PATH_SIZE];
+    bool cache = formats > 0 && cachePath(key, path);
+    GLuint prog = cache ? loadCached(path, key) : 0;
+    if (prog) {
+        printf("program %016llx: cached, %.3f ms\n", (unsigned long long)key, (now() - start) * 1e3);
+        return prog;
+    }
+    prog = compileProgram(defines, attribs, nAttribs, cache);
+    if (prog && cache)
+        storeCached(path, key, prog);
+    printf("program %016llx: compiled%s, %.3f ms\n", (unsigned long long)key,
+           cache ? "" : " (no binary cache)", (now() - start) * 1e3);
+    return prog;
+}
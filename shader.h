@@ -0,0 +1,17 @@
+#pragma once
+#include <GL/glew.h>
+
+// programs of the shaders built into the binary (v.glsl and f.glsl, turned
+// into shaders.h by build.sh). linked programs are kept in a binary cache,
+// $XDG_CACHE_HOME/hlbsp or ~/.cache/hlbsp, one file per key of sources,
+// defines, attributes and driver strings, so a driver update misses; an
+// entry the driver does not take back is compiled again
+
+typedef struct {
+    GLuint index;
+    const char *name;
+} attrib_t;
+
+// defines go between the #version line and the source, attribs are bound
+// before linking; 0 on compile or link errors, which are printed
+GLuint programLoad(const char *defines, const attrib_t *attribs, int nAttribs);
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sim.h"
+
+double simTime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleepUntil(double t) {
+    struct timespec ts = {(time_t)t, (long)((t - (time_t)t) * 1e9)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+bool inputPush(inputq_t *q, const inputevent_t *ev) {
+    unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&q->tail, memory_order_acquire) == INPUT_QUEUE) {
+        q->dropped++;
+        return false;
+    }
+    q->events[head % INPUT_QUEUE] = *ev;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool inputPop(inputq_t *q, inputevent_t *ev) {
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&q->head, memory_order_acquire))
+        return false;
+    *ev = q->events[tail % INPUT_QUEUE];
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static void snapshotWrite(snapbuf_t *b, const snapshot_t *snap) {
+    unsigned i = atomic_load_explicit(&b->latest, memory_order_relaxed) ^ 1;
+    unsigned seq = atomic_load_explicit(&b->seq[i], memory_order_relaxed);
+    atomic_store_explicit(&b->seq[i], seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&b->slots[i], snap, sizeof(*snap));
+    atomic_store_explicit(&b->seq[i], seq + 2, memory_order_release);
+    atomic_store_explicit(&b->latest, i, memory_order_release);
+}
+
+void snapshotRead(snapbuf_t *b, snapshot_t *out) {
+    while (true) {
+        unsigned i = atomic_load_explicit(&b->latest, memory_order_acquire);
+        unsigned seq = atomic_load_explicit(&b->seq[i], memory_order_acquire);
+        if (seq & 1)
+            continue;
+        memcpy(out, &b->slots[i], sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&b->seq[i], memory_order_relaxed) == seq)
+            return;
+    }
+}
+
+void statsInit(stats_t *s, uint32_t cap) {
+    memset(s, 0, sizeof(*s));
+    s->samples = malloc(sizeof(float) * cap);
+    s->cap = cap;
+}
+
+void statsFree(stats_t *s) {
+    free(s->samples);
+    memset(s, 0, sizeof(*s));
+}
+
+void statsAdd(stats_t *s, float ms) {
+    s->samples[s->total % s->cap] = ms;
+    s->total++;
+    if (s->n < s->cap)
+        s->n++;
+}
+
+static int cmpFloat(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+void statsSummary(const stats_t *s, statsummary_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->count = s->total;
+    if (s->n == 0)
+        return;
+    float *sorted = malloc(sizeof(float) * s->n);
+    memcpy(sorted, s->samples, sizeof(float) * s->n);
+    qsort(sorted, s->n, sizeof(float), cmpFloat);
+    double sum = 0.0;
+    for (uint32_t i = 0; i < s->n; i++)
+        sum += sorted[i];
+    out->avg = sum / s->n;
+    out->p50 = sorted[s->n * 50 / 100];
+    out->p99 = sorted[s->n * 99 / 100];
+    out->max = sorted[s->n - 1];
+    free(sorted);
+}
+
+void lookAdd(vec3 ang, float yaw, float pitch) {
+    ang[0] += yaw;
+    if (ang[0] >= 180.0f)
+        ang[0] -= 360.0f;
+    if (ang[0] < -180.0f)
+        ang[0] += 360.0f;
+    ang[1] = glm_clamp(ang[1] + pitch, -89.0f, 89.0f);
+}
+
+// apply the queued events, the time of the oldest, 0 if there were none
+static double drainInput(sim_t *s) {
+    double oldest = 0.0;
+    inputevent_t ev;
+    while (inputPop(&s->input, &ev)) {
+        if (oldest == 0.0)
+            oldest = ev.time;
+        switch (ev.kind) {
+        case IN_BUTTON:
+            if (ev.down)
+                s->buttons |= ev.button;
+            else
+                s->buttons &= ~ev.button;
+            break;
+        case IN_LOOK:
+            lookAdd(s->ang, ev.yaw, ev.pitch);
+            break;
+        case IN_RELEASE:
+            s->buttons = 0;
+            break;
+        }
+    }
+    return oldest;
+}
+
+static void *simThread(void *arg) {
+    sim_t *s = arg;
+    double tick = 1.0 / s->tickrate;
+    double next = simTime();
+    snapshot_t snap;
+    memset(&snap, 0, sizeof(snap));
+    player_eye(&s->pl, snap.eye);
+    uint64_t pendingTick = 0; // last tick published with snap.inputTime
+    while (!atomic_load_explicit(&s->quit, memory_order_relaxed)) {
+        sleepUntil(next);
+        double late = simTime() - next;
+        statsAdd(&s->late, late * 1e3);
+        // after a stall start over, instead of running all the ticks missed
+        if (late > 0.25)
+            next = simTime();
+
+        ZigLoadBSP *bsp = atomic_exchange_explicit(&s->nextBsp, NULL, memory_order_acquire);
+        if (bsp) {
+            s->bsp = bsp;
+            player_t spawn = {.verbose = true};
+            s->pl = spawn;
+            player_eye(&s->pl, snap.eye);
+        }
+        // input stays in the snapshots until the reader has seen one of them
+        if (atomic_load_explicit(&s->ackTick, memory_order_acquire) >= pendingTick)
+            snap.inputTime = 0.0;
+        double oldest = drainInput(s);
+        if (snap.inputTime == 0.0)
+            snap.inputTime = oldest;
+
+        glm_vec3_copy(snap.eye, snap.prevEye);
+        if (s->bsp) {
+            usercmd_t cmd = {s->ang[0], s->ang[1], s->buttons};
+            // a scroll step goes into one cmd only
+            s->buttons &= ~(BTN_SCROLLUP | BTN_SCROLLDN);
+            if (s->demo)
+                demoWrite(s->demo, &cmd);
+            player_move(s->bsp, &s->pl, &cmd, tick);
+            player_eye(&s->pl, snap.eye);
+        }
+        snap.tick++;
+        snap.time = next;
+        glm_vec3_copy(s->ang, snap.ang);
+        snap.pl = s->pl;
+        snap.bsp = s->bsp;
+        snapshotWrite(&s->snaps, &snap);
+        if (snap.inputTime != 0.0)
+            pendingTick = snap.tick;
+        next += tick;
+    }
+    return NULL;
+}
+
+bool simStart(sim_t *s, int tickrate, demo_t *demo) {
+    memset(s, 0, sizeof(*s));
+    s->tickrate = tickrate;
+    s->demo = demo;
+    s->pl.verbose = true;
+    atomic_init(&s->input.head, 0);
+    atomic_init(&s->input.tail, 0);
+    atomic_init(&s->snaps.latest, 0);
+    atomic_init(&s->snaps.seq[0], 0);
+    atomic_init(&s->snaps.seq[1], 0);
+    atomic_init(&s->quit, false);
+    atomic_init(&s->nextBsp, NULL);
+    atomic_init(&s->ackTick, 0);
+    statsInit(&s->late, 1 << 16);
+    // tick 0, before the thread runs
+    player_eye(&s->pl, s->snaps.slots[0].eye);
+    glm_vec3_copy(s->snaps.slots[0].eye, s->snaps.slots[0].prevEye);
+    s->snaps.slots[0].time = simTime();
+    s->snaps.slots[0].pl = s->pl;
+    s->running = pthread_create(&s->thread, NULL, simThread, s) == 0;
+    if (!s->running)
+        statsFree(&s->late);
+    return s->running;
+}
+
+void simStop(sim_t *s) {
+    if (!s->running)
+        return;
+    atomic_store_explicit(&s->quit, true, memory_order_relaxed);
+    pthread_join(s->thread, NULL);
+    s->running = false;
+}
+
+void simFree(sim_t *s) {
+    simStop(s);
+    statsFree(&s->late);
+}
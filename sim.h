@@ -0,0 +1,108 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "bsp.h"
+#include "player.h"
+#include "demo.h"
+
+// input, movement and drawing on their own threads: the window callbacks
+// push input events into a lock-free single producer, single consumer
+// queue, the simulation thread drains it every tick at a fixed rate and
+// publishes a snapshot of the player through a double buffer, and the
+// render thread draws the latest snapshot; a slow frame no longer delays
+// input or movement, nor the other way round
+
+double simTime(void); // seconds, monotonic, the clock of all time stamps
+
+typedef enum {
+    IN_BUTTON,  // button goes down or up
+    IN_LOOK,    // yaw and pitch to add
+    IN_RELEASE, // all buttons up, the window let go of the input
+} inputkind_t;
+
+typedef struct {
+    double time; // simTime when it came in
+    float yaw, pitch; // IN_LOOK, degrees
+    uint16_t button;  // IN_BUTTON, a BTN_*, BTN_SCROLL* are up after one tick
+    uint8_t kind;     // inputkind_t
+    bool down;
+} inputevent_t;
+
+// add an IN_LOOK to yaw and pitch in ang, the simulation and the camera
+// of the input thread both go through this, so they agree to the bit
+void lookAdd(vec3 ang, float yaw, float pitch);
+
+#define INPUT_QUEUE 1024 // events, power of two
+
+typedef struct {
+    _Alignas(64) atomic_uint head; // next to write, only the producer stores it
+    _Alignas(64) atomic_uint tail; // next to read, only the consumer stores it
+    uint32_t dropped; // by the producer, the queue was full
+    inputevent_t events[INPUT_QUEUE];
+} inputq_t;
+
+bool inputPush(inputq_t *q, const inputevent_t *ev); // false if full
+bool inputPop(inputq_t *q, inputevent_t *ev);        // false if empty
+
+// the state after one tick, all the render thread needs
+typedef struct {
+    uint64_t tick;
+    double time;       // scheduled simTime of the tick, the view is interpolated from there
+    vec3 prevEye, eye; // of the tick before and this one
+    vec3 ang;          // view
+    player_t pl;
+    ZigLoadBSP *bsp;   // moved in, NULL before the first map
+    double inputTime;  // oldest input not acknowledged by the reader yet, 0 if none
+} snapshot_t;
+
+// the writer fills the slot that is not the latest, a reader copies the
+// latest and tries again if its sequence number changed meanwhile
+typedef struct {
+    atomic_uint latest;
+    atomic_uint seq[2]; // odd while the slot is written
+    snapshot_t slots[2];
+} snapbuf_t;
+
+void snapshotRead(snapbuf_t *b, snapshot_t *out);
+
+// sorted samples of a running measurement, ms
+typedef struct {
+    float *samples;
+    uint32_t cap, n; // the last cap are kept
+    uint64_t total;
+} stats_t;
+
+typedef struct {
+    uint64_t count;
+    float avg, p50, p99, max;
+} statsummary_t;
+
+void statsInit(stats_t *s, uint32_t cap);
+void statsFree(stats_t *s);
+void statsAdd(stats_t *s, float ms);
+void statsSummary(const stats_t *s, statsummary_t *out);
+
+typedef struct {
+    pthread_t thread;
+    bool running;
+    int tickrate;
+    demo_t *demo; // records every tick if not NULL
+    inputq_t input;
+    snapbuf_t snaps;
+    atomic_bool quit;
+    _Atomic(ZigLoadBSP *) nextBsp; // the next map, taken at the start of a tick
+    atomic_uint_fast64_t ackTick;  // last tick the reader has seen
+    // owned by the simulation thread until simStop
+    ZigLoadBSP *bsp;
+    player_t pl;
+    vec3 ang;
+    uint16_t buttons;
+    stats_t late; // how late each tick started against its schedule
+} sim_t;
+
+bool simStart(sim_t *s, int tickrate, demo_t *demo);
+// join the thread; the player and the stats stay valid until simFree
+void simStop(sim_t *s);
+void simFree(sim_t *s);
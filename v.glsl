@@ -1,12 +1,29 @@
-#version 330 core
-
 uniform mat4 mvp;
 
 in vec3 vtxPos;
 in vec2 texPos;
+in vec2 lmPos;
+out vec2 lmCoord;
+#ifdef TEXARRAY
+in float texLayer;
+out vec3 texCoord;
+#else
 out vec2 texCoord;
+#endif
+#ifdef PALETTE
+in float texIndex;
+flat out float palRow;
+#endif
 
 void main() {
   gl_Position = mvp * vec4(vtxPos, 1.0);
+  lmCoord = lmPos;
+#ifdef TEXARRAY
+  texCoord = vec3(texPos, texLayer);
+#else
   texCoord = texPos;
-}
\ No newline at end of file
+#endif
+#ifdef PALETTE
+  palRow = texIndex;
+#endif
+}